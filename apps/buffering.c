@@ -43,6 +43,8 @@
 #include "logf.h"
 
 #define BUF_MAX_HANDLES 384
+/* Slots in the id -> handle table (power of 2, >= BUF_MAX_HANDLES) */
+#define BUF_HANDLE_TABLE_SIZE 512
 
 /* macros to enable logf for queues
    logging on SYS_TIMEOUT can be disabled */
@@ -67,8 +69,15 @@
 
 #define GUARD_BUFSIZE   (32*1024)
 
-/* amount of data to read in one read() call */
+/* amount of data to read in one read() call; buffer_handle() goes up to
+   the maximum when storage is fast enough and the buffer isn't low */
 #define BUFFERING_DEFAULT_FILECHUNK      (1024*32)
+#define BUFFERING_MAX_FILECHUNK          (1024*256)
+/* aim for reads taking about this long, so the queue is still checked
+   often enough */
+#define BUFFERING_CHUNK_TICKS            (HZ/20)
+/* fold the read time into the throughput estimate after this many ticks */
+#define BUFFERING_RATE_TICKS             (HZ/10)
 
 enum handle_flags
 {
@@ -77,6 +86,16 @@ enum handle_flags
     H_FIXEDDATA = 0x4,   /* Data is fixed in position */
 };
 
+/* Per-handle read statistics, for the debug screen */
+struct handle_stats {
+    unsigned long bytes;    /* Bytes read from the file */
+    unsigned long ticks;    /* Ticks spent in read() */
+    unsigned int  reads;
+    unsigned int  rebuffers;
+    unsigned int  waits;
+    unsigned int  latency[BUF_LATENCY_BINS];
+};
+
 struct memory_handle {
     struct lld_node hnode;  /* Handle list node (first!) */
     struct lld_node mrunode;/* MRU list node (second!) */
@@ -94,6 +113,7 @@ struct memory_handle {
     off_t   start;          /* Offset at which we started reading the file */
     off_t   pos;            /* Read position in file */
     off_t volatile end;     /* Offset at which we stopped reading the file */
+    struct handle_stats stats; /* Read statistics */
     char    path[];         /* Path if data originated in a file */
 };
 
@@ -120,6 +140,14 @@ static struct lld_head mru_cache;   /* MRU-ordered list of handles */
 static int num_handles;             /* number of handles in the lists */
 static int base_handle_id;
 
+/* Direct-mapped id -> handle table in front of the MRU list. Ids are handed
+   out sequentially, so live handles seldom share a slot; when they do, the
+   loser is found on the list and takes the slot over. */
+static struct memory_handle *handle_table[BUF_HANDLE_TABLE_SIZE];
+
+#define HANDLE_SLOT(id) \
+    (&handle_table[(unsigned int)(id) & (BUF_HANDLE_TABLE_SIZE - 1)])
+
 /* Main lock for adding / removing handles */
 static struct mutex llist_mutex SHAREDBSS_ATTR;
 
@@ -149,6 +177,15 @@ static struct data_counters
     size_t useful;      /* Amount of data still useful to the user */
 } data_counters;
 
+/* Storage throughput, measured by buffer_handle() */
+static struct
+{
+    unsigned long rate;     /* Estimated bytes per tick, 0 if unknown yet */
+    unsigned long bytes;    /* Read since the estimate was last updated */
+    unsigned long ticks;
+    unsigned int rebuffers; /* Total, for the debug screen */
+} read_stats;
+
 
 /* Messages available to communicate with the buffering thread */
 enum
@@ -272,6 +309,9 @@ unlink_handle : Remove a handle from the list
 find_handle   : Get a handle pointer from an ID
 move_handle   : Move a handle in the buffer (with or without its data)
 
+All of them keep handle_table in step, so that find_handle normally resolves
+an ID with one lookup and only walks the MRU cache on a slot collision.
+
 These functions only handle the linked list structure. They don't touch the
 contents of the struct memory_handle headers.
 
@@ -306,6 +346,7 @@ static void link_handle(struct memory_handle *h)
 {
     lld_insert_last(&handle_list, &h->hnode);
     lld_insert_first(&mru_cache, &h->mrunode);
+    *HANDLE_SLOT(h->id) = h;
     num_handles++;
 }
 
@@ -314,6 +355,11 @@ static void unlink_handle(struct memory_handle *h)
 {
     lld_remove(&handle_list, &h->hnode);
     lld_remove(&mru_cache, &h->mrunode);
+
+    struct memory_handle **slot = HANDLE_SLOT(h->id);
+    if (*slot == h)
+        *slot = NULL;
+
     num_handles--;
 }
 
@@ -414,6 +460,7 @@ add_handle(unsigned int flags, size_t data_size, const char *path,
     h->flags    = flags;
     h->pinned   = 0; /* Can be moved */
     h->signaled = 0; /* Data can be waited for */
+    memset(&h->stats, 0, sizeof(h->stats));
 
     /* Save the provided path */
     if (path)
@@ -429,7 +476,14 @@ add_handle(unsigned int flags, size_t data_size, const char *path,
    NULL if the handle wasn't found */
 static struct memory_handle * find_handle(int handle_id)
 {
-    struct memory_handle *h = NULL;
+    struct memory_handle **slot = HANDLE_SLOT(handle_id);
+    struct memory_handle *h = *slot;
+
+    if (h && h->id == handle_id)
+        return h;
+
+    h = NULL;
+
     struct lld_node *mru = mru_cache.head;
     struct lld_node *m = mru;
 
@@ -444,6 +498,7 @@ static struct memory_handle * find_handle(int handle_id)
         }
 
         h = MRU_HANDLE(m);
+        *slot = h;
     }
 
     return h;
@@ -515,6 +570,10 @@ static bool move_handle(struct memory_handle **h, size_t *delta,
     adjust_handle_node(&handle_list, &src->hnode, &dest->hnode);
     adjust_handle_node(&mru_cache, &src->mrunode, &dest->mrunode);
 
+    struct memory_handle **slot = HANDLE_SLOT(src->id);
+    if (*slot == src)
+        *slot = dest;
+
     /* x = handle(s) following this one...
      * ...if last handle, unmoveable if metadata, only shrinkable if audio.
      * In other words, no legal move can be made that would have the src head
@@ -619,6 +678,47 @@ static int update_data_counters(struct data_counters *dc)
     return num;
 }
 
+/* Size of the next read. Reads stay short while the useful data is below
+   the watermark so that it shows up soon; above it, they grow to take about
+   BUFFERING_CHUNK_TICKS at the measured throughput, which means fewer and
+   longer bursts before the disk can sleep again. */
+static size_t read_chunk_size(void)
+{
+    if (data_counters.useful < BUF_WATERMARK || read_stats.rate == 0)
+        return BUFFERING_DEFAULT_FILECHUNK;
+
+    size_t chunk = MIN(read_stats.rate * BUFFERING_CHUNK_TICKS,
+                       (size_t)BUFFERING_MAX_FILECHUNK);
+    return MAX(ALIGN_DOWN(chunk, BUFFERING_DEFAULT_FILECHUNK),
+               (size_t)BUFFERING_DEFAULT_FILECHUNK);
+}
+
+/* Account for a read of rc bytes that took ticks. Most reads take less than
+   a tick, but summed over many reads the tick count is still a fair
+   measure of the time spent. */
+static void record_read(struct memory_handle *h, ssize_t rc, long ticks)
+{
+    struct handle_stats *st = &h->stats;
+    int bin = 0;
+
+    while (bin < BUF_LATENCY_BINS - 1 && ticks >= (1l << bin))
+        bin++;
+
+    st->latency[bin]++;
+    st->reads++;
+    st->bytes += rc;
+    st->ticks += ticks;
+
+    read_stats.bytes += rc;
+    read_stats.ticks += ticks;
+    if (read_stats.ticks >= BUFFERING_RATE_TICKS) {
+        unsigned long rate = read_stats.bytes / read_stats.ticks;
+        read_stats.rate = read_stats.rate ?
+                          (read_stats.rate * 3 + rate) / 4 : rate;
+        read_stats.bytes = read_stats.ticks = 0;
+    }
+}
+
 /* Q_BUFFER_HANDLE event and buffer data for the given handle.
    Return whether or not the buffering should continue explicitly.  */
 static bool buffer_handle(int handle_id, size_t to_buffer)
@@ -662,12 +762,13 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
     }
 
     bool stop = false;
+    size_t chunk = read_chunk_size();
     while (h->end < h->filesize && !stop)
     {
         /* max amount to copy */
         size_t widx = h->widx;
         ssize_t copy_n = h->filesize - h->end;
-        copy_n = MIN(copy_n, BUFFERING_DEFAULT_FILECHUNK);
+        copy_n = MIN(copy_n, (off_t)chunk);
         copy_n = MIN(copy_n, (off_t)(buffer_len - widx));
 
         mutex_lock(&llist_mutex);
@@ -689,6 +790,7 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
             return false; /* no space for read */
 
         /* rc is the actual amount read */
+        long tick = current_tick;
         ssize_t rc = read(h->fd, ringbuf_ptr(widx), copy_n);
 
         if (rc <= 0) {
@@ -704,6 +806,8 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
             break;
         }
 
+        record_read(h, rc, current_tick - tick);
+
         /* Advance buffer and make data available to users */
         h->widx = ringbuf_add(widx, rc);
         h->end += rc;
@@ -1212,6 +1316,9 @@ static void rebuffer_handle(int handle_id, off_t newpos)
     size_t new_index = h->data;
 #endif /* STORAGE_WANTS_ALIGN */
 
+    h->stats.rebuffers++;
+    read_stats.rebuffers++;
+
     /* Reset the handle to its new position */
     h->ridx = h->widx = h->data = new_index;
     h->start = h->pos = h->end = newpos;
@@ -1344,6 +1451,8 @@ static struct memory_handle *prep_bufdata(int handle_id, size_t *size,
         /* Wait for the data to be ready */
         unsigned int request = 1;
 
+        h->stats.waits++;
+
         do
         {
             if (--request == 0) {
@@ -1723,9 +1832,11 @@ bool buffering_reset(char *buf, size_t buflen)
 
     lld_init(&handle_list);
     lld_init(&mru_cache);
+    memset(handle_table, 0, sizeof(handle_table));
 
     num_handles = 0;
     base_handle_id = -1;
+    read_stats.rebuffers = 0; /* the throughput estimate still holds */
 
     /* Set the high watermark as 75% full...or 25% empty :)
        This is the greatest fullness that will trigger low-buffer events
@@ -1748,4 +1859,28 @@ void buffering_get_debugdata(struct buffering_debug *dbgdata)
     dbgdata->buffered_data = dc.buffered;
     dbgdata->useful_data = dc.useful;
     dbgdata->watermark = BUF_WATERMARK;
+    dbgdata->chunk_size = read_chunk_size();
+    dbgdata->read_rate = read_stats.rate * HZ;
+    dbgdata->rebuffers = read_stats.rebuffers;
+    dbgdata->num_handle_stats = 0;
+
+    mutex_lock(&llist_mutex);
+
+    struct memory_handle *h = find_handle(base_handle_id) ?: HLIST_FIRST;
+    for (; h && dbgdata->num_handle_stats < BUF_DEBUG_HANDLES;
+         h = HLIST_NEXT(h)) {
+        struct buffering_handle_debug *hd =
+            &dbgdata->handles[dbgdata->num_handle_stats++];
+        const struct handle_stats *st = &h->stats;
+
+        hd->id = h->id;
+        hd->type = h->type;
+        hd->fill_rate = st->ticks ? st->bytes / st->ticks * HZ : 0;
+        hd->reads = st->reads;
+        hd->rebuffers = st->rebuffers;
+        hd->waits = st->waits;
+        memcpy(hd->latency, st->latency, sizeof(hd->latency));
+    }
+
+    mutex_unlock(&llist_mutex);
 }
@@ -115,12 +115,30 @@ void buf_set_watermark(size_t bytes);
 size_t buf_get_watermark(void);
 
 /* Debugging */
+#define BUF_LATENCY_BINS    6   /* reads of <1, 1, 2-3, 4-7, 8-15, 16+ ticks */
+#define BUF_DEBUG_HANDLES   4   /* handles reported, from the base handle on */
+
+struct buffering_handle_debug {
+    int id;
+    int type;                   /* enum data_type */
+    unsigned long fill_rate;    /* bytes/s while reading this handle */
+    unsigned int reads;
+    unsigned int rebuffers;     /* seeks that dropped the buffered data */
+    unsigned int waits;         /* reads that had to wait for buffering */
+    unsigned int latency[BUF_LATENCY_BINS];
+};
+
 struct buffering_debug {
     int num_handles;
     size_t buffered_data;
     size_t data_rem;
     size_t useful_data;
     size_t watermark;
+    size_t chunk_size;          /* current read chunk */
+    unsigned long read_rate;    /* measured storage throughput, bytes/s */
+    unsigned int rebuffers;     /* since the buffer was reset */
+    int num_handle_stats;
+    struct buffering_handle_debug handles[BUF_DEBUG_HANDLES];
 };
 void buffering_get_debugdata(struct buffering_debug *dbgdata);
 
@@ -2,6 +2,7 @@
 #include "button.h"
 #include "config.h"
 #include "core_alloc.h"
+#include "crc32.h"
 #include "dir.h"
 #include "file.h"
 #include "gui/statusbar.h"
@@ -12,6 +13,7 @@
 #include "pathfuncs.h"
 #include "playlist.h"
 #include "powermgmt.h"
+#include "rbpaths.h"
 #include "recorder/bmp.h"
 #include "recorder/jpeg_load.h" /* For read_jpeg_file */
 #include "settings.h"
@@ -21,6 +23,10 @@
 #include "string.h"
 #include "system.h"
 
+#ifdef HAVE_TAGCACHE
+#include "custom_db.h"
+#endif
+
 /* Internal Coverflow App Port */
 #include "gui/viewport.h"
 
@@ -46,35 +52,93 @@
 #define GAP_OFFSET 70
 #define STACK_OFFSET 35
 
-#define MAX_ALBUMS 300 /* Stable limit */
-
 /* Album structure */
 struct Album {
   char path[MAX_PATH];
   char name[96];       /* Balanced name length */
   char cover_file[32]; /* Reduced */
+  uint32_t cover_mtime;
+  uint32_t cover_size;
   bool is_jpeg;
   bool has_art;
   struct bitmap cover_bmp;
   size_t cache_offset; /* Relative to cache_base */
   bool loaded;
+  bool cover_checked; /* cover_file/has_art are valid */
+  unsigned serial;    /* changes whenever cover_bmp is (re)loaded */
 };
 
 static struct Album *albums = NULL; /* Now dynamic */
 static int *slot_owners = NULL;     /* Tracks which album is in which slot */
 static int album_count = 0;
+static int album_capacity = 0;
 static int current_index = 0;
-static float anim_pos = 0.0f;
+static int anim_offset = 0; /* see ANIM_ONE */
 
 #define NUM_ART_SLOTS 16
 #define ALBUM_CACHE_SIZE (2048 * 1024) /* 2MB Cache */
 #define SCRATCH_SIZE (512 * 1024)      /* 512KB Scratch for JPEGs */
-#define ALBUM_STRUCTS_SIZE (MAX_ALBUMS * sizeof(struct Album))
 #define SLOT_OWNERS_SIZE (NUM_ART_SLOTS * sizeof(int))
 
+/* Persistent thumbnail cache: covers already scaled to native format, so a
+ * later session reads the pixels straight into the art slot instead of
+ * decoding and resizing the original image again.
+ *
+ * File layout: header, index of THUMB_CACHE_ENTRIES records, then pixel
+ * data appended in the order thumbnails were made. A record is valid when
+ * path hash, mtime and size of the cover file all match. When the index or
+ * the data area is full the cache is simply started over. */
+#define THUMB_CACHE_FILE ROCKBOX_DIR "/coverflow.tcf"
+#define THUMB_CACHE_MAGIC 0x43465431 /* "CFT1" */
+#define THUMB_CACHE_ENTRIES 2048
+#define THUMB_CACHE_MAX_DATA (128 * 1024 * 1024)
+
+struct thumb_cache_header {
+  uint32_t magic;
+  uint32_t count;    /* used index records */
+  uint32_t data_end; /* file offset where the next thumbnail goes */
+};
+
+struct thumb_cache_entry {
+  uint32_t key; /* crc32 of the cover path */
+  uint32_t mtime;
+  uint32_t size;
+  uint16_t width;
+  uint16_t height;
+  uint32_t offset;
+};
+
+#define THUMB_DATA_START                                                       \
+  (sizeof(struct thumb_cache_header) +                                         \
+   THUMB_CACHE_ENTRIES * sizeof(struct thumb_cache_entry))
+#define THUMB_INDEX_SIZE                                                       \
+  (THUMB_CACHE_ENTRIES * sizeof(struct thumb_cache_entry))
+
+/* Layout of the memory block: the fixed size areas, then the album array
+ * which is cut down to the albums actually found */
+#define ART_CACHE_OFFSET SLOT_OWNERS_SIZE
+#define SCRATCH_OFFSET (ART_CACHE_OFFSET + ALBUM_CACHE_SIZE)
+#define THUMB_INDEX_OFFSET (SCRATCH_OFFSET + SCRATCH_SIZE)
+#define ALBUMS_OFFSET (THUMB_INDEX_OFFSET + THUMB_INDEX_SIZE)
+
+/* RAM left to everybody else while the album list is being built, and the
+ * room to ask for regardless when even that is not available */
+#define ALBUM_LIST_RESERVE (256 * 1024)
+#define MIN_ALBUM_SPACE (300 * sizeof(struct Album))
+
 static int coverflow_mem_handle = -1;
 static unsigned char *scratch_ptr = NULL;
 
+/* Point the globals into the memory block, which may have moved while it
+ * was unpinned */
+static void refresh_pointers(void) {
+  unsigned char *mem_base =
+      (unsigned char *)core_get_data(coverflow_mem_handle);
+  slot_owners = (int *)mem_base;
+  scratch_ptr = mem_base + SCRATCH_OFFSET;
+  albums = (struct Album *)(mem_base + ALBUMS_OFFSET);
+}
+
 /* ... headers ... */
 
 static enum AppState { STATE_BROWSE, STATE_MENU } current_state;
@@ -157,8 +221,107 @@ void get_parent_name(const char *path, char *dest) {
   simple_basename(tmp, dest);
 }
 
+static void set_cover(struct Album *alb, const char *cover_name,
+                      const struct dirinfo *info) {
+  strlcpy(alb->cover_file, cover_name, sizeof(alb->cover_file));
+  alb->has_art = true;
+  alb->cover_mtime = info->mtime;
+  alb->cover_size = info->size;
+  const char *ext = strrchr(cover_name, '.');
+  alb->is_jpeg =
+      (ext && (strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0));
+}
+
+/* Look for the cover of an album that was listed without reading its
+ * folder. Runs on the loader thread. */
+static void find_cover(struct Album *alb) {
+  alb->cover_checked = true;
+  alb->has_art = false;
+
+  DIR *dir = opendir(alb->path);
+  if (!dir)
+    return;
+
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.')
+      continue;
+    struct dirinfo info = dir_get_info(dir, entry);
+    if (!(info.attribute & ATTR_DIRECTORY) && is_cover_file(entry->d_name)) {
+      set_cover(alb, entry->d_name, &info);
+      break;
+    }
+  }
+  closedir(dir);
+}
+
+/* Append the folder at path to the album list, NULL if it is full or the
+ * folder is not shown */
+static struct Album *add_album(const char *path) {
+  if (album_count >= album_capacity)
+    return NULL;
+
+  char base_name[MAX_PATH];
+  simple_basename(path, base_name);
+  if (strcasecmp(base_name, "Musica Flac") == 0)
+    return NULL;
+
+  struct Album *alb = &albums[album_count];
+  memset(alb, 0, sizeof(*alb));
+  strlcpy(alb->path, path, sizeof(alb->path));
+
+  if (is_disc_folder(base_name)) {
+    char parent_name[MAX_PATH];
+    get_parent_name(path, parent_name);
+    snprintf(alb->name, sizeof(alb->name), "%s (%s)", parent_name, base_name);
+  } else {
+    strlcpy(alb->name, base_name, sizeof(alb->name));
+  }
+
+  album_count++;
+  return alb;
+}
+
+#ifdef HAVE_TAGCACHE
+/* Album list from the custom database: one album per folder holding tracks,
+ * in database (artist, album) order. Folders seen before are found again
+ * through hash, an open addressing table of hash_mask + 1 album indices, so
+ * a compilation spread over several artists still shows up once. Covers are
+ * looked up later by the loader, only for albums that come into view. */
+static void list_albums_from_db(int *hash, int hash_mask) {
+  int entries = custom_db_get_entry_count();
+  char dir[MAX_PATH];
+  dir[0] = '\0';
+
+  for (int i = 0; i < entries && album_count < album_capacity; i++) {
+    struct db_entry e;
+    if (!custom_db_get_entry(i, &e))
+      break;
+
+    const char *path = custom_db_get_string(e.path_idx);
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : 0;
+    if (len == 0 || len >= sizeof(dir))
+      continue;
+    if (strncmp(dir, path, len) == 0 && dir[len] == '\0')
+      continue; /* same folder as the previous track */
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+
+    int slot = crc_32(dir, len, 0xffffffff) & hash_mask;
+    while (hash[slot] >= 0 && strcmp(albums[hash[slot]].path, dir) != 0)
+      slot = (slot + 1) & hash_mask;
+    if (hash[slot] >= 0)
+      continue;
+
+    if (add_album(dir))
+      hash[slot] = album_count - 1;
+  }
+}
+#endif /* HAVE_TAGCACHE */
+
 void scan_recursive(const char *path, int depth) {
-  if (depth > 5 || album_count >= MAX_ALBUMS)
+  if (depth > 5 || album_count >= album_capacity)
     return;
 
   DIR *dir = opendir(path);
@@ -168,6 +331,7 @@ void scan_recursive(const char *path, int depth) {
   bool found_music = false;
   char found_cover[64];
   found_cover[0] = '\0';
+  struct dirinfo cover_info = {0};
 
   struct dirent *entry;
   while ((entry = readdir(dir))) {
@@ -180,46 +344,20 @@ void scan_recursive(const char *path, int depth) {
         found_music = true;
       if (found_cover[0] == '\0' && is_cover_file(entry->d_name)) {
         strcpy(found_cover, entry->d_name);
+        cover_info = info;
       }
     }
   }
 
-  if (depth > 0 && found_music) {
-    strcpy(albums[album_count].path, path);
-    char base_name[MAX_PATH];
-    simple_basename(path, base_name);
-
-    if (strcasecmp(base_name, "Musica Flac") == 0)
-      goto skip_album_add;
-
-    if (is_disc_folder(base_name)) {
-      char parent_name[MAX_PATH];
-      get_parent_name(path, parent_name);
-      snprintf(albums[album_count].name, sizeof(albums[album_count].name),
-               "%s (%s)", parent_name, base_name);
-    } else {
-      strlcpy(albums[album_count].name, base_name,
-              sizeof(albums[album_count].name));
-    }
-
-    if (found_cover[0] != '\0') {
-      strlcpy(albums[album_count].cover_file, found_cover,
-              sizeof(albums[album_count].cover_file));
-      albums[album_count].has_art = true;
-      char *ext = strrchr(found_cover, '.');
-      albums[album_count].is_jpeg = (ext && (strcasecmp(ext, ".jpg") == 0 ||
-                                             strcasecmp(ext, ".jpeg") == 0));
-    } else {
-      /* Parent Cover Check logic omitted for brevity/RAM saving in native/fast
-         implementation Use default cover logic instead if needed, or re-add if
-         user demands it. Keeping it simple: No art found in folder = No art.
-      */
-      albums[album_count].has_art = false;
-    }
-
-    albums[album_count].loaded = false;
-    memset(&albums[album_count].cover_bmp, 0, sizeof(struct bitmap));
-    album_count++;
+  struct Album *alb;
+  if (depth > 0 && found_music && (alb = add_album(path))) {
+    /* Parent Cover Check logic omitted for brevity/RAM saving in native/fast
+       implementation Use default cover logic instead if needed, or re-add if
+       user demands it. Keeping it simple: No art found in folder = No art.
+    */
+    if (found_cover[0] != '\0')
+      set_cover(alb, found_cover, &cover_info);
+    alb->cover_checked = true;
 
     if (album_count % 10 == 0) {
       char msg[32];
@@ -227,15 +365,13 @@ void scan_recursive(const char *path, int depth) {
       splash(0, msg);
       lcd_update();
     }
-
-  skip_album_add:;
   }
   closedir(dir);
 
   /* Pass 2: Recurse */
   dir = opendir(path);
   if (dir) {
-    while ((entry = readdir(dir)) && album_count < MAX_ALBUMS) {
+    while ((entry = readdir(dir)) && album_count < album_capacity) {
       if (entry->d_name[0] == '.')
         continue;
       if (strcasecmp(entry->d_name, "System Volume Information") == 0)
@@ -254,108 +390,463 @@ void scan_recursive(const char *path, int depth) {
   }
 }
 
-void load_cover_native(int index) {
-  if (index < 0 || index >= album_count || albums[index].loaded)
+/* Background cover loader: decodes covers around current_index ahead of the
+ * scroll direction so that drawing never waits on read_jpeg_file(). Albums
+ * that are not loaded yet are drawn as a placeholder. The window must fit
+ * in the art slots, otherwise the loader would evict covers it just loaded */
+#define PREFETCH_RANGE 6
+#define VISIBLE_RANGE 5
+
+#if NUM_ART_SLOTS < 2 * PREFETCH_RANGE + 1
+#error "NUM_ART_SLOTS too small for the prefetch window"
+#endif
+
+enum { Q_LOADER_WAKE = 1, Q_LOADER_EXIT };
+
+static struct event_queue loader_queue SHAREDBSS_ATTR;
+static long loader_stack[(DEFAULT_STACK_SIZE + 0x2000) / sizeof(long)];
+static const char loader_thread_name[] = "coverflow";
+static unsigned int loader_thread_id = 0;
+
+static int want_center = 0; /* album the prefetch window is centred on */
+static int want_dir = 1;    /* last scroll direction, +1 or -1 */
+static volatile bool covers_changed = false; /* a visible cover got loaded */
+static unsigned cover_serial = 0;
+
+/* The thumbnail cache is only touched by the loader thread; its index lives
+ * in the pinned memory block and is passed in by the caller */
+static int thumb_fd = -1;
+static struct thumb_cache_header thumb_hdr;
+
+static bool thumb_cache_reset(struct thumb_cache_entry *thumbs) {
+  if (thumb_fd >= 0)
+    close(thumb_fd);
+  thumb_fd = open(THUMB_CACHE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (thumb_fd < 0)
+    return false;
+
+  thumb_hdr.magic = THUMB_CACHE_MAGIC;
+  thumb_hdr.count = 0;
+  thumb_hdr.data_end = THUMB_DATA_START;
+  memset(thumbs, 0, THUMB_INDEX_SIZE);
+  if (write(thumb_fd, &thumb_hdr, sizeof(thumb_hdr)) != sizeof(thumb_hdr) ||
+      write(thumb_fd, thumbs, THUMB_INDEX_SIZE) != (ssize_t)THUMB_INDEX_SIZE) {
+    close(thumb_fd);
+    thumb_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+static void thumb_cache_open(struct thumb_cache_entry *thumbs) {
+  thumb_fd = open(THUMB_CACHE_FILE, O_RDWR);
+  if (thumb_fd >= 0) {
+    ssize_t index_len;
+    if (read(thumb_fd, &thumb_hdr, sizeof(thumb_hdr)) == sizeof(thumb_hdr) &&
+        thumb_hdr.magic == THUMB_CACHE_MAGIC &&
+        thumb_hdr.count <= THUMB_CACHE_ENTRIES &&
+        thumb_hdr.data_end >= THUMB_DATA_START) {
+      index_len = thumb_hdr.count * sizeof(struct thumb_cache_entry);
+      if (read(thumb_fd, thumbs, index_len) == index_len)
+        return;
+    }
+  }
+  thumb_cache_reset(thumbs);
+}
+
+static void thumb_cache_close(void) {
+  if (thumb_fd >= 0) {
+    close(thumb_fd);
+    thumb_fd = -1;
+  }
+}
+
+static struct thumb_cache_entry *
+thumb_cache_find(struct thumb_cache_entry *thumbs, uint32_t key) {
+  for (uint32_t i = 0; i < thumb_hdr.count; i++) {
+    if (thumbs[i].key == key)
+      return &thumbs[i];
+  }
+  return NULL;
+}
+
+static bool thumb_cache_write_at(off_t offset, const void *buf, size_t len) {
+  return lseek(thumb_fd, offset, SEEK_SET) == offset &&
+         write(thumb_fd, buf, len) == (ssize_t)len;
+}
+
+/* Store a freshly decoded cover. Pixel data goes to disk before the index
+ * record and the header that point at it. */
+static void thumb_cache_store(struct thumb_cache_entry *thumbs, uint32_t key,
+                              const struct Album *alb,
+                              const struct bitmap *bm) {
+  if (thumb_fd < 0)
     return;
 
-  if (!albums[index].has_art) {
-    albums[index].loaded = true;
-    albums[index].cover_bmp.width = 0;
+  uint32_t bytes = bm->width * bm->height * sizeof(fb_data);
+  struct thumb_cache_entry *e = thumb_cache_find(thumbs, key);
+
+  if (!e || e->width * e->height * sizeof(fb_data) != bytes) {
+    bool full = (!e && thumb_hdr.count >= THUMB_CACHE_ENTRIES) ||
+                thumb_hdr.data_end + bytes > THUMB_CACHE_MAX_DATA;
+    if (full) {
+      if (!thumb_cache_reset(thumbs))
+        return;
+      e = NULL;
+    }
+    if (!e)
+      e = &thumbs[thumb_hdr.count++];
+    e->offset = thumb_hdr.data_end;
+    thumb_hdr.data_end += bytes;
+  }
+
+  e->key = key;
+  e->mtime = alb->cover_mtime;
+  e->size = alb->cover_size;
+  e->width = bm->width;
+  e->height = bm->height;
+
+  off_t rec = sizeof(thumb_hdr) + (e - thumbs) * sizeof(*e);
+  if (!thumb_cache_write_at(e->offset, bm->data, bytes) ||
+      !thumb_cache_write_at(rec, e, sizeof(*e)) ||
+      !thumb_cache_write_at(0, &thumb_hdr, sizeof(thumb_hdr))) {
+    /* Leave whatever made it to disk to the header check next time */
+    thumb_cache_close();
+  }
+}
+
+/* Read a cached thumbnail into bm->data, false if there is none that is
+ * still valid for this cover */
+static bool thumb_cache_load(struct thumb_cache_entry *thumbs, uint32_t key,
+                             const struct Album *alb, struct bitmap *bm,
+                             size_t maxsize) {
+  if (thumb_fd < 0)
+    return false;
+
+  struct thumb_cache_entry *e = thumb_cache_find(thumbs, key);
+  if (!e || e->mtime != alb->cover_mtime || e->size != alb->cover_size)
+    return false;
+
+  size_t bytes = e->width * e->height * sizeof(fb_data);
+  if (bytes == 0 || bytes > maxsize)
+    return false;
+  if (lseek(thumb_fd, e->offset, SEEK_SET) != (off_t)e->offset ||
+      read(thumb_fd, bm->data, bytes) != (ssize_t)bytes)
+    return false;
+
+  bm->width = e->width;
+  bm->height = e->height;
+  return true;
+}
+
+/* Runs on the loader thread with the memory handle pinned at mem_base */
+static void load_cover_native(unsigned char *mem_base, int index) {
+  struct Album *alb_base = (struct Album *)(mem_base + ALBUMS_OFFSET);
+  int *owners = (int *)mem_base;
+  struct thumb_cache_entry *thumbs =
+      (struct thumb_cache_entry *)(mem_base + THUMB_INDEX_OFFSET);
+  struct Album *alb = &alb_base[index];
+
+  if (!alb->cover_checked)
+    find_cover(alb);
+
+  if (!alb->has_art) {
+    alb->loaded = true;
+    alb->cover_bmp.width = 0;
     return;
   }
 
-  /* Resolve base addresses */
-  unsigned char *mem_base =
-      (unsigned char *)core_get_data(coverflow_mem_handle);
-  unsigned char *cache_base = mem_base + ALBUM_STRUCTS_SIZE + SLOT_OWNERS_SIZE;
+  unsigned char *cache_base = mem_base + ART_CACHE_OFFSET;
 
   size_t slot_size = ALBUM_CACHE_SIZE / NUM_ART_SLOTS;
   slot_size &= ~31;
   int slot = index % NUM_ART_SLOTS;
 
-  /* If this slot was owned by another album, mark that album as NOT loaded */
-  if (slot_owners[slot] != -1 && slot_owners[slot] < album_count) {
-    albums[slot_owners[slot]].loaded = false;
+  /* If this slot was owned by another album, mark that album as NOT loaded
+   * before the decoder starts overwriting its pixels */
+  if (owners[slot] != -1 && owners[slot] < album_count) {
+    alb_base[owners[slot]].loaded = false;
   }
-  slot_owners[slot] = index;
+  owners[slot] = index;
 
   char path[MAX_PATH];
-  snprintf(path, sizeof(path), "%s/%s", albums[index].path,
-           albums[index].cover_file);
+  snprintf(path, sizeof(path), "%s/%s", alb->path, alb->cover_file);
 
-  albums[index].cache_offset = (slot * slot_size);
+  alb->cache_offset = (slot * slot_size);
   struct bitmap load_bm;
+  memset(&load_bm, 0, sizeof(load_bm));
   load_bm.width = 200;
   load_bm.height = 200;
-  load_bm.data = cache_base + albums[index].cache_offset;
+  load_bm.data = cache_base + alb->cache_offset;
 
   int flags = FORMAT_NATIVE | FORMAT_RESIZE | FORMAT_KEEP_ASPECT;
   int result;
+  uint32_t key = crc_32(path, strlen(path), 0xffffffff);
 
-  if (albums[index].is_jpeg) {
-    result = read_jpeg_file(path, &load_bm, slot_size, flags, NULL);
+  if (thumb_cache_load(thumbs, key, alb, &load_bm, slot_size)) {
+    result = 1;
   } else {
-    result = read_bmp_file(path, &load_bm, slot_size, flags, NULL);
+    /* Both decoders yield between rows, so the UI keeps running meanwhile */
+    if (alb->is_jpeg) {
+      result = read_jpeg_file(path, &load_bm, slot_size, flags, NULL);
+    } else {
+      result = read_bmp_file(path, &load_bm, slot_size, flags, NULL);
+    }
+    if (result > 0)
+      thumb_cache_store(thumbs, key, alb, &load_bm);
   }
 
   if (result > 0) {
-    albums[index].cover_bmp = load_bm;
+    alb->cover_bmp = load_bm;
     /* Store slot-relative data pointer for structural integrity */
-    albums[index].cover_bmp.data = (void *)albums[index].cache_offset;
+    alb->cover_bmp.data = (void *)alb->cache_offset;
   } else {
-    albums[index].cover_bmp.width = 0;
+    alb->cover_bmp.width = 0;
+  }
+  alb->serial = ++cover_serial;
+  alb->loaded = true;
+
+  int dist = index - want_center;
+  if (dist >= -VISIBLE_RANGE && dist <= VISIBLE_RANGE)
+    covers_changed = true;
+}
+
+/* Centre first, then alternate outwards starting on the side the user is
+ * scrolling towards */
+static int next_cover_to_load(const struct Album *alb_base) {
+  int center = want_center;
+  int dir = want_dir;
+
+  if (center >= 0 && center < album_count && !alb_base[center].loaded)
+    return center;
+
+  for (int d = 1; d <= PREFETCH_RANGE; d++) {
+    int ahead = center + d * dir;
+    int behind = center - d * dir;
+    if (ahead >= 0 && ahead < album_count && !alb_base[ahead].loaded)
+      return ahead;
+    if (behind >= 0 && behind < album_count && !alb_base[behind].loaded)
+      return behind;
+  }
+  return -1;
+}
+
+static void loader_thread(void) {
+  struct queue_event ev;
+
+  core_pin(coverflow_mem_handle);
+  thumb_cache_open((struct thumb_cache_entry *)(
+      (unsigned char *)core_get_data(coverflow_mem_handle) +
+      THUMB_INDEX_OFFSET));
+  core_unpin(coverflow_mem_handle);
+
+  while (1) {
+    /* Keep the buffer from moving while the decoder writes into it; the UI
+     * thread unpins its own reference while idle */
+    core_pin(coverflow_mem_handle);
+    unsigned char *mem_base =
+        (unsigned char *)core_get_data(coverflow_mem_handle);
+    int index =
+        next_cover_to_load((struct Album *)(mem_base + ALBUMS_OFFSET));
+    if (index >= 0)
+      load_cover_native(mem_base, index);
+    core_unpin(coverflow_mem_handle);
+
+    queue_wait_w_tmo(&loader_queue, &ev,
+                     index >= 0 ? TIMEOUT_NOBLOCK : TIMEOUT_BLOCK);
+    if (ev.id == Q_LOADER_EXIT) {
+      thumb_cache_close();
+      return;
+    }
+  }
+}
+
+/* Move the prefetch window; dir is the direction of the last step */
+static void loader_request(int center, int dir) {
+  want_center = center;
+  if (dir != 0)
+    want_dir = dir > 0 ? 1 : -1;
+  if (loader_thread_id != 0)
+    queue_post(&loader_queue, Q_LOADER_WAKE, 0);
+}
+
+static bool loader_start(void) {
+  queue_init(&loader_queue, false);
+  loader_thread_id =
+      create_thread(loader_thread, loader_stack, sizeof(loader_stack), 0,
+                    loader_thread_name IF_PRIO(, PRIORITY_BACKGROUND)
+                        IF_COP(, CPU));
+  if (loader_thread_id == 0) {
+    queue_delete(&loader_queue);
+    return false;
   }
-  albums[index].loaded = true;
+  loader_request(current_index, 0);
+  return true;
 }
 
-void scale_bitmap_3d(const struct bitmap *src, struct bitmap *dst, int w, int h,
-                     bool apply_perspective) {
-  if (!src->data || src->width <= 0)
+/* Must be called before the memory handle goes away: waits for a decode in
+ * progress to finish */
+static void loader_stop(void) {
+  if (loader_thread_id == 0)
     return;
-  dst->width = w;
-  dst->height = h;
-  unsigned short *s_data = (unsigned short *)src->data;
-  unsigned short *d_data = (unsigned short *)dst->data;
-  int x_ratio = (int)((src->width << 16) / w) + 1;
-  int y_ratio = (int)((src->height << 16) / h) + 1;
+  queue_post(&loader_queue, Q_LOADER_EXIT, 0);
+  thread_wait(loader_thread_id);
+  queue_delete(&loader_queue);
+  loader_thread_id = 0;
+}
+
+/* Perspective warp of a cover to w x h, worked out once per size instead
+ * of per pixel. Each output row has a source row and a blank margin on
+ * either side; the span in between steps through the source row in 16.16
+ * fixed point. Flat covers have the same span on every row, so there the
+ * source column of every output column is kept instead. */
+#define WARP_MAX_W CENTER_WIDTH
+#define WARP_MAX_H CENTER_HEIGHT
+#define WARP_TABLES 4
+
+struct warp_table {
+  short w, h, src_w, src_h;
+  bool perspective;
+  short src_y[WARP_MAX_H];
+  short margin[WARP_MAX_H];
+  int step[WARP_MAX_H];
+  short src_x[WARP_MAX_W];
+};
+
+static struct warp_table warp_tables[WARP_TABLES];
+static int warp_next = 0;
+
+static const struct warp_table *get_warp_table(int src_w, int src_h, int w,
+                                               int h, bool perspective) {
+  struct warp_table *t;
+  for (int i = 0; i < WARP_TABLES; i++) {
+    t = &warp_tables[i];
+    if (t->w == w && t->h == h && t->src_w == src_w && t->src_h == src_h &&
+        t->perspective == perspective)
+      return t;
+  }
+
+  t = &warp_tables[warp_next];
+  warp_next = (warp_next + 1) % WARP_TABLES;
+  t->w = w;
+  t->h = h;
+  t->src_w = src_w;
+  t->src_h = src_h;
+  t->perspective = perspective;
 
+  int y_ratio = ((src_h << 16) / h) + 1;
   for (int y = 0; y < h; y++) {
-    int sy = (y * y_ratio) >> 16;
+    t->src_y[y] = (y * y_ratio) >> 16;
     int margin = 0;
-
-    if (apply_perspective) {
+    if (perspective) {
       int center_y = h / 2;
       int dist = (y < center_y) ? (center_y - y) : (y - center_y);
       margin = (dist * w) / (h * 3);
     }
+    t->margin[y] = margin;
+    t->step[y] = (src_w << 16) / (w - 2 * margin);
+  }
 
-    for (int x = 0; x < w; x++) {
-      if (apply_perspective && (x < margin || x > (w - margin))) {
-        d_data[y * w + x] = lcd_get_background();
-        continue;
-      }
+  int x_ratio = ((src_w << 16) / w) + 1;
+  for (int x = 0; x < w; x++)
+    t->src_x[x] = (x * x_ratio) >> 16;
 
-      int sx;
-      if (apply_perspective) {
-        int effective_line_w = w - 2 * margin;
-        if (effective_line_w <= 0)
-          effective_line_w = 1;
-        sx = ((x - margin) * src->width) / effective_line_w;
-      } else {
-        sx = (x * x_ratio) >> 16;
-      }
+  return t;
+}
+
+/* Reflection strength at its top edge, in 1/32 */
+#define REFLECTION_ALPHA 12
+
+#if LCD_PIXELFORMAT == RGB565
+/* a/32 of fg over bg, all three channels in one multiply */
+static inline fb_data blend_rgb565(unsigned fg, unsigned bg, unsigned a) {
+  uint32_t f = (fg | (fg << 16)) & 0x07e0f81f;
+  uint32_t b = (bg | (bg << 16)) & 0x07e0f81f;
+  uint32_t r = ((((f - b) * a) >> 5) + b) & 0x07e0f81f;
+  return (fb_data)(r | (r >> 16));
+}
+#endif
+
+/* Warp src into dst (w x h), followed by rh rows of fading reflection */
+static void warp_cover(const struct bitmap *src, fb_data *dst, int w, int h,
+                       int rh, bool perspective) {
+  const fb_data *s_data = (const fb_data *)src->data;
+  const fb_data bg = lcd_get_background();
+  const struct warp_table *t =
+      get_warp_table(src->width, src->height, w, h, perspective);
+
+  for (int y = 0; y < h; y++) {
+    const fb_data *srow = s_data + t->src_y[y] * src->width;
+    fb_data *drow = dst + y * w;
+    int x = 0;
 
-      if (sx < 0)
-        sx = 0;
-      if (sx >= src->width)
-        sx = src->width - 1;
-      d_data[y * w + x] = s_data[sy * src->width + sx];
+    if (!perspective) {
+      for (; x < w; x++)
+        drow[x] = srow[t->src_x[x]];
+      continue;
     }
+
+    int margin = t->margin[y];
+    int step = t->step[y];
+    int acc = 0;
+    for (; x < margin; x++)
+      drow[x] = bg;
+    for (; x < w - margin; x++, acc += step)
+      drow[x] = srow[acc >> 16];
+    for (; x < w; x++)
+      drow[x] = bg;
   }
+
+#if LCD_PIXELFORMAT == RGB565
+  for (int r = 0; r < rh; r++) {
+    const fb_data *srow = dst + (h - 1 - r) * w;
+    fb_data *drow = dst + (h + r) * w;
+    unsigned a = REFLECTION_ALPHA * (rh - r) / rh;
+    for (int x = 0; x < w; x++)
+      drow[x] = blend_rgb565(srow[x], bg, a);
+  }
+#else
+  (void)rh;
+#endif
 }
 
-void render_album(int index, int x, int y, int w, int h, bool use_3d) {
-  load_cover_native(index);
+/* Reflection rows drawn under a cover of height h */
+static int reflection_height(int h) {
+#if LCD_PIXELFORMAT == RGB565
+  return REFLECTION_HEIGHT * h / CENTER_HEIGHT;
+#else
+  (void)h;
+  return 0;
+#endif
+}
+
+/* Side covers at rest all have the same size, so once warped they are kept
+ * in the scratch area behind the work buffer, one entry per art slot, and
+ * reused for as long as the album's cover stays loaded */
+#define WARP_WORK_SIZE                                                         \
+  (WARP_MAX_W * (WARP_MAX_H + REFLECTION_HEIGHT) * sizeof(fb_data))
+#define SIDE_REFLECTION (REFLECTION_HEIGHT * SIDE_HEIGHT / CENTER_HEIGHT)
+#define SIDE_COVER_SIZE                                                        \
+  (SIDE_WIDTH * (SIDE_HEIGHT + SIDE_REFLECTION) * sizeof(fb_data))
+
+struct side_cover {
+  int index; /* album, -1 if unused */
+  unsigned serial;
+};
+
+static struct side_cover side_covers[NUM_ART_SLOTS];
+static int side_cover_count = 0;
+
+static void side_covers_init(void) {
+  side_cover_count = (SCRATCH_SIZE - WARP_WORK_SIZE) / SIDE_COVER_SIZE;
+  if (side_cover_count > NUM_ART_SLOTS)
+    side_cover_count = NUM_ART_SLOTS;
+  for (int i = 0; i < NUM_ART_SLOTS; i++)
+    side_covers[i].index = -1;
+}
+
+static void render_album(int index, int x, int y, int w, int h,
+                         bool use_3d) {
   struct Album *alb = &albums[index];
 
   if (!alb->loaded || alb->cover_bmp.width == 0) {
@@ -367,54 +858,136 @@ void render_album(int index, int x, int y, int w, int h, bool use_3d) {
     lcd_drawline(cx - s, cy + s, cx + s, cy);
     return;
   }
+  if (w <= 0 || h <= 0 || w > WARP_MAX_W || h > WARP_MAX_H)
+    return;
+
+  int rh = reflection_height(h);
+  fb_data *out = (fb_data *)scratch_ptr;
+
+  if (use_3d && w == SIDE_WIDTH && h == SIDE_HEIGHT && side_cover_count > 0) {
+    int slot = index % side_cover_count;
+    out = (fb_data *)(scratch_ptr + WARP_WORK_SIZE + slot * SIDE_COVER_SIZE);
+    if (side_covers[slot].index == index &&
+        side_covers[slot].serial == alb->serial) {
+      lcd_bitmap(out, x, y, w, h + rh);
+      return;
+    }
+    side_covers[slot].index = index;
+    side_covers[slot].serial = alb->serial;
+  }
 
   /* Resolve dynamic pointer: Base + StructsArea + SlotsArea +
    * AlbumOffsetInCache
    */
   unsigned char *mem_base =
       (unsigned char *)core_get_data(coverflow_mem_handle);
-  unsigned char *cache_base = mem_base + ALBUM_STRUCTS_SIZE + SLOT_OWNERS_SIZE;
+  unsigned char *cache_base = mem_base + ART_CACHE_OFFSET;
   struct bitmap real_bm = alb->cover_bmp;
   real_bm.data = cache_base + alb->cache_offset;
 
-  struct bitmap scaled_bm;
-  scaled_bm.data = scratch_ptr;
-  scale_bitmap_3d(&real_bm, &scaled_bm, w, h, use_3d);
-  lcd_bitmap((fb_data *)scaled_bm.data, x, y, w, h);
+  warp_cover(&real_bm, out, w, h, rh, use_3d);
+  lcd_bitmap(out, x, y, w, h + rh);
 }
 
-void draw_coverflow_frame(void) {
-  lcd_set_foreground(LCD_BLACK);
+/* The view is at current_index + anim_offset, with anim_offset in units of
+ * albums in 16.16 fixed point. Only the offset is fractional so that any
+ * number of albums fits; it is kept small since the view never needs to
+ * start further away than just off screen. */
+#define ANIM_ONE (1 << 16)
+#define ANIM_EPSILON (ANIM_ONE / 200)
+#define ANIM_MAX_ALBUMS (VISIBLE_RANGE + 1)
+#define ANIM_MAX_OFFSET (ANIM_MAX_ALBUMS * ANIM_ONE)
+
+/* v * frac, truncated towards zero like the float version was */
+static inline int anim_scale(int v, int frac) {
+  return v * frac / ANIM_ONE;
+}
 
-  int center_idx = (int)(anim_pos + 0.5f);
-  int range = 5;
+/* Damage tracking: a frame is laid out as a list of what goes where, in
+ * drawing order. Comparing it with the list of the frame on screen gives
+ * the area that actually changed, and only that is redrawn and sent to
+ * the LCD. */
+struct frame_item {
+  int index; /* album */
+  bool title;
+  bool use_3d;
+  bool ready; /* cover rather than the placeholder */
+  unsigned serial;
+  short x, y, w, h; /* cover, or title text */
+};
+
+#define MAX_FRAME_ITEMS (2 * VISIBLE_RANGE + 2)
+
+struct frame {
+  int count;
+  struct frame_item items[MAX_FRAME_ITEMS];
+};
+
+struct rect {
+  int x1, y1, x2, y2; /* x2/y2 exclusive, empty when x1 >= x2 */
+};
+
+static struct frame frames[2];
+static int shown_frame = -1; /* index into frames, -1 if nothing shown */
+
+/* Make index the current album; the view stays where it is on screen and
+ * slides over from there, or from just off screen if that is further */
+static void select_album(int index) {
+  int delta = current_index - index;
+  delta = MAX(-2 * ANIM_MAX_ALBUMS, MIN(delta, 2 * ANIM_MAX_ALBUMS));
+  anim_offset += delta * ANIM_ONE;
+  anim_offset = MAX(-ANIM_MAX_OFFSET, MIN(anim_offset, ANIM_MAX_OFFSET));
+  current_index = index;
+}
+
+static void add_cover(struct frame *f, int index, int x, int y, int w, int h,
+                      bool use_3d) {
+  struct frame_item *it = &f->items[f->count++];
+  memset(it, 0, sizeof(*it)); /* compared with memcmp() */
+  it->index = index;
+  it->use_3d = use_3d;
+  it->ready = albums[index].loaded && albums[index].cover_bmp.width != 0;
+  it->serial = it->ready ? albums[index].serial : 0;
+  it->x = x;
+  it->y = y;
+  it->w = w;
+  it->h = h;
+}
+
+static void layout_frame(struct frame *f) {
+  f->count = 0;
+
+  /* Nearest album, rounding the biased (non-negative) offset down */
+  int center_idx = current_index - ANIM_MAX_ALBUMS +
+                   (anim_offset + ANIM_MAX_OFFSET + ANIM_ONE / 2) / ANIM_ONE;
+  int range = VISIBLE_RANGE;
 
   /* Right Side */
   for (int i = range; i >= 1; i--) {
     int idx = center_idx + i;
     if (idx >= album_count)
       continue;
-    float dist = (float)idx - anim_pos;
+    int dist = (idx - current_index) * ANIM_ONE - anim_offset;
     int w, h, x, y;
 
-    if (dist >= 1.0f) {
+    if (dist >= ANIM_ONE) {
       w = SIDE_WIDTH;
       h = SIDE_HEIGHT;
-      int stack_dist = (int)((dist - 1.0f) * STACK_OFFSET);
+      int stack_dist = anim_scale(STACK_OFFSET, dist - ANIM_ONE);
       x = (LCD_WIDTH / 2) + (CENTER_WIDTH / 2) + GAP_OFFSET + stack_dist -
           (SIDE_WIDTH / 2);
       y = Y_OFFSET + (CENTER_HEIGHT - SIDE_HEIGHT) / 2;
     } else {
-      w = CENTER_WIDTH - (int)((CENTER_WIDTH - SIDE_WIDTH) * dist);
-      h = CENTER_HEIGHT - (int)((CENTER_HEIGHT - SIDE_HEIGHT) * dist);
+      w = CENTER_WIDTH - anim_scale(CENTER_WIDTH - SIDE_WIDTH, dist);
+      h = CENTER_HEIGHT - anim_scale(CENTER_HEIGHT - SIDE_HEIGHT, dist);
       int center_pos_x = LCD_WIDTH / 2;
       int side_pos_x = (LCD_WIDTH / 2) + (CENTER_WIDTH / 2) + GAP_OFFSET;
       int cur_center_x =
-          center_pos_x + (int)((side_pos_x - center_pos_x) * dist);
+          center_pos_x + anim_scale(side_pos_x - center_pos_x, dist);
       x = cur_center_x - (w / 2);
       y = Y_OFFSET + (CENTER_HEIGHT - h) / 2;
     }
-    render_album(idx, x, y, w, h, true);
+    add_cover(f, idx, x, y, w, h, true);
   }
 
   /* Left Side */
@@ -422,53 +995,166 @@ void draw_coverflow_frame(void) {
     int idx = center_idx - i;
     if (idx < 0)
       continue;
-    float dist = anim_pos - (float)idx;
+    int dist = anim_offset - (idx - current_index) * ANIM_ONE;
     int w, h, x, y;
-    if (dist >= 1.0f) {
+    if (dist >= ANIM_ONE) {
       w = SIDE_WIDTH;
       h = SIDE_HEIGHT;
-      int stack_dist = (int)((dist - 1.0f) * STACK_OFFSET);
+      int stack_dist = anim_scale(STACK_OFFSET, dist - ANIM_ONE);
       x = (LCD_WIDTH / 2) - (CENTER_WIDTH / 2) - GAP_OFFSET - stack_dist -
           (SIDE_WIDTH / 2);
       y = Y_OFFSET + (CENTER_HEIGHT - SIDE_HEIGHT) / 2;
     } else {
-      w = CENTER_WIDTH - (int)((CENTER_WIDTH - SIDE_WIDTH) * dist);
-      h = CENTER_HEIGHT - (int)((CENTER_HEIGHT - SIDE_HEIGHT) * dist);
+      w = CENTER_WIDTH - anim_scale(CENTER_WIDTH - SIDE_WIDTH, dist);
+      h = CENTER_HEIGHT - anim_scale(CENTER_HEIGHT - SIDE_HEIGHT, dist);
       int center_pos_x = LCD_WIDTH / 2;
       int side_pos_x = (LCD_WIDTH / 2) - (CENTER_WIDTH / 2) - GAP_OFFSET;
       int cur_center_x =
-          center_pos_x + (int)((side_pos_x - center_pos_x) * dist);
+          center_pos_x + anim_scale(side_pos_x - center_pos_x, dist);
       x = cur_center_x - (w / 2);
       y = Y_OFFSET + (CENTER_HEIGHT - h) / 2;
     }
-    render_album(idx, x, y, w, h, true);
+    add_cover(f, idx, x, y, w, h, true);
   }
 
   /* Center */
   if (center_idx >= 0 && center_idx < album_count) {
-    float dist = anim_pos - (float)center_idx;
-    float abs_dist = dist > 0 ? dist : -dist;
-    int w = CENTER_WIDTH - (int)((CENTER_WIDTH - SIDE_WIDTH) * abs_dist);
-    int h = CENTER_HEIGHT - (int)((CENTER_HEIGHT - SIDE_HEIGHT) * abs_dist);
+    int dist = anim_offset - (center_idx - current_index) * ANIM_ONE;
+    int abs_dist = dist > 0 ? dist : -dist;
+    int w = CENTER_WIDTH - anim_scale(CENTER_WIDTH - SIDE_WIDTH, abs_dist);
+    int h = CENTER_HEIGHT - anim_scale(CENTER_HEIGHT - SIDE_HEIGHT, abs_dist);
     int center_pos_x = LCD_WIDTH / 2;
     int target_x = (dist > 0)
                        ? ((LCD_WIDTH / 2) - (CENTER_WIDTH / 2) - GAP_OFFSET)
                        : ((LCD_WIDTH / 2) + (CENTER_WIDTH / 2) + GAP_OFFSET);
     int cur_center_x =
-        center_pos_x + (int)((target_x - center_pos_x) * abs_dist);
+        center_pos_x + anim_scale(target_x - center_pos_x, abs_dist);
     int x = cur_center_x - (w / 2);
     int y = Y_OFFSET + (CENTER_HEIGHT - h) / 2;
-    render_album(center_idx, x, y, w, h, false);
+    add_cover(f, center_idx, x, y, w, h, false);
 
-    if (abs_dist < 0.2f) {
+    if (abs_dist < ANIM_ONE / 5) {
+      struct frame_item *it = &f->items[f->count++];
       int tw, th;
       lcd_getstringsize(albums[center_idx].name, &tw, &th);
-      lcd_putsxy((LCD_WIDTH - tw) / 2, Y_OFFSET + CENTER_HEIGHT + 10,
-                 albums[center_idx].name);
+      memset(it, 0, sizeof(*it));
+      it->index = center_idx;
+      it->title = true;
+      it->x = (LCD_WIDTH - tw) / 2;
+      it->y = Y_OFFSET + CENTER_HEIGHT + reflection_height(CENTER_HEIGHT) + 10;
+      it->w = tw;
+      it->h = th;
     }
   }
 }
 
+/* Screen area an item covers, reflection included */
+static void item_rect(const struct frame_item *it, struct rect *r) {
+  r->x1 = it->x;
+  r->y1 = it->y;
+  r->x2 = it->x + it->w;
+  r->y2 = it->y + it->h + (it->title ? 0 : reflection_height(it->h));
+}
+
+static void rect_union(struct rect *r, const struct rect *add) {
+  if (add->x1 >= add->x2 || add->y1 >= add->y2)
+    return;
+  if (r->x1 >= r->x2 || r->y1 >= r->y2) {
+    *r = *add;
+    return;
+  }
+  r->x1 = MIN(r->x1, add->x1);
+  r->y1 = MIN(r->y1, add->y1);
+  r->x2 = MAX(r->x2, add->x2);
+  r->y2 = MAX(r->y2, add->y2);
+}
+
+static bool frame_has(const struct frame *f, const struct frame_item *it) {
+  for (int i = 0; i < f->count; i++) {
+    if (!memcmp(&f->items[i], it, sizeof(*it)))
+      return true;
+  }
+  return false;
+}
+
+/* Bounding box of everything that differs between the two frames */
+static void frame_damage(const struct frame *old, const struct frame *cur,
+                         struct rect *damage) {
+  struct rect r;
+  for (int i = 0; i < cur->count; i++) {
+    if (!frame_has(old, &cur->items[i])) {
+      item_rect(&cur->items[i], &r);
+      rect_union(damage, &r);
+    }
+  }
+  for (int i = 0; i < old->count; i++) {
+    if (!frame_has(cur, &old->items[i])) {
+      item_rect(&old->items[i], &r);
+      rect_union(damage, &r);
+    }
+  }
+}
+
+/* Draw the items of f that reach into damage, with damage as viewport */
+static void draw_frame(const struct frame *f, const struct rect *damage) {
+  lcd_set_foreground(LCD_BLACK);
+
+  for (int i = 0; i < f->count; i++) {
+    const struct frame_item *it = &f->items[i];
+    struct rect r;
+    item_rect(it, &r);
+    if (r.x2 <= damage->x1 || r.x1 >= damage->x2 || r.y2 <= damage->y1 ||
+        r.y1 >= damage->y2)
+      continue;
+
+    int x = it->x - damage->x1;
+    int y = it->y - damage->y1;
+    if (it->title)
+      lcd_putsxy(x, y, albums[it->index].name);
+    else
+      render_album(it->index, x, y, it->w, it->h, it->use_3d);
+  }
+}
+
+/* Lay out the current state and bring the screen up to date with it */
+static void update_coverflow_frame(const struct viewport *content_vp) {
+  int next = shown_frame == 0 ? 1 : 0;
+  struct frame *f = &frames[next];
+  struct rect damage = {0, 0, 0, 0};
+
+  lcd_set_viewport((struct viewport *)content_vp);
+  layout_frame(f);
+
+  if (shown_frame < 0) {
+    damage.x2 = content_vp->width;
+    damage.y2 = content_vp->height;
+  } else {
+    frame_damage(&frames[shown_frame], f, &damage);
+  }
+  shown_frame = next;
+
+  damage.x1 = MAX(damage.x1, 0);
+  damage.y1 = MAX(damage.y1, 0);
+  damage.x2 = MIN(damage.x2, content_vp->width);
+  damage.y2 = MIN(damage.y2, content_vp->height);
+  if (damage.x1 >= damage.x2 || damage.y1 >= damage.y2)
+    return;
+
+  struct viewport vp = *content_vp;
+  vp.x += damage.x1;
+  vp.y += damage.y1;
+  vp.width = damage.x2 - damage.x1;
+  vp.height = damage.y2 - damage.y1;
+  lcd_set_viewport(&vp);
+  lcd_set_background(LCD_WHITE);
+  lcd_clear_viewport();
+
+  draw_frame(f, &damage);
+
+  lcd_update_rect(vp.x, vp.y, vp.width, vp.height);
+  lcd_set_viewport((struct viewport *)content_vp);
+}
+
 bool coverflow_app(void) {
   /* 1. Reset everything to a known clean state on entry */
   lcd_set_viewport(NULL);
@@ -477,39 +1163,99 @@ bool coverflow_app(void) {
   lcd_clear_display();
   lcd_update();
 
-  /* Allocate ALL App RAM Dynamically (Free on Start Music) */
-  size_t total_required =
-      ALBUM_STRUCTS_SIZE + SLOT_OWNERS_SIZE + ALBUM_CACHE_SIZE + SCRATCH_SIZE;
-  coverflow_mem_handle = core_alloc(total_required);
+#ifdef HAVE_TAGCACHE
+  /* Before the big allocation below, so that it may still go to RAM. Only
+   * needed until the album list is built. */
+  bool from_db = custom_db_init();
+  if (from_db && custom_db_get_entry_count() <= 0) {
+    custom_db_close();
+    from_db = false;
+  }
+#endif
+
+  /* Allocate ALL App RAM Dynamically (Free on Start Music). The album list
+   * gets whatever is free for now and is cut down once it is built. */
+  size_t alloc_size = core_allocatable();
+  if (alloc_size < ALBUMS_OFFSET + MIN_ALBUM_SPACE + ALBUM_LIST_RESERVE)
+    alloc_size = ALBUMS_OFFSET + MIN_ALBUM_SPACE;
+  else
+    alloc_size -= ALBUM_LIST_RESERVE;
+  alloc_size &= ~3;
+
+  coverflow_mem_handle = core_alloc(alloc_size);
   if (coverflow_mem_handle < 0) {
+#ifdef HAVE_TAGCACHE
+    if (from_db)
+      custom_db_close();
+#endif
     splash(HZ * 2, "Error: No RAM for RockIpod!");
     return false;
   }
   core_pin(coverflow_mem_handle);
   unsigned char *mem_base =
       (unsigned char *)core_get_data(coverflow_mem_handle);
-  memset(mem_base, 0, total_required); /* CRITICAL: Clear uninitialized RAM */
+  memset(mem_base, 0, ALBUMS_OFFSET); /* CRITICAL: Clear uninitialized RAM */
 
-  albums = (struct Album *)mem_base;
-  slot_owners = (int *)(mem_base + ALBUM_STRUCTS_SIZE);
+  refresh_pointers();
   for (int i = 0; i < NUM_ART_SLOTS; i++)
     slot_owners[i] = -1;
 
-  scratch_ptr =
-      mem_base + ALBUM_STRUCTS_SIZE + SLOT_OWNERS_SIZE + ALBUM_CACHE_SIZE;
-
-  splash(HZ, "Scanning Library...");
-
+  size_t list_space = alloc_size - ALBUMS_OFFSET;
   album_count = 0;
-  scan_recursive("/", 0);
+  album_capacity = list_space / sizeof(struct Album);
+
+#ifdef HAVE_TAGCACHE
+  if (from_db) {
+    /* Folder lookup table at the end of the block, load factor <= 1/2 */
+    size_t max_albums =
+        list_space / (sizeof(struct Album) + 2 * sizeof(int));
+    int hash_size = 1;
+    while ((size_t)hash_size * 2 <= 2 * max_albums)
+      hash_size *= 2;
+    int *hash = (int *)(mem_base + alloc_size - hash_size * sizeof(int));
+    album_capacity = MIN((size_t)hash_size / 2,
+                         (list_space - hash_size * sizeof(int)) /
+                             sizeof(struct Album));
+    memset(hash, 0xff, hash_size * sizeof(int));
+    list_albums_from_db(hash, hash_size - 1);
+    custom_db_close();
+  } else
+#endif
+  {
+    splash(0, "Scanning Library...");
+    scan_recursive("/", 0);
+  }
 
   if (album_count == 0) {
+    core_unpin(coverflow_mem_handle);
+    core_free(coverflow_mem_handle);
+    coverflow_mem_handle = -1;
+    albums = NULL;
     splash(HZ * 2, "No Albums Found");
     return false;
   }
 
+  /* Give back what the list did not use; the block keeps its start */
+  core_shrink(coverflow_mem_handle, mem_base,
+              ALBUMS_OFFSET + album_count * sizeof(struct Album));
+  album_capacity = album_count;
+  if (current_index >= album_count)
+    current_index = 0;
+
+  if (!loader_start()) {
+    splash(HZ * 2, "Error: Cannot start cover loader");
+    core_unpin(coverflow_mem_handle);
+    core_free(coverflow_mem_handle);
+    coverflow_mem_handle = -1;
+    albums = NULL;
+    return false;
+  }
+
+  side_covers_init();
+  shown_frame = -1;
+
   current_state = STATE_BROWSE;
-  anim_pos = current_index;
+  anim_offset = 0;
   bool dirty = true;
   bool exit_app = false;
   bool start_playing = false;
@@ -533,13 +1279,16 @@ bool coverflow_app(void) {
   gui_statusbar_draw(&statusbars.statusbars[SCREEN_MAIN], true, &status_vp);
 
   while (!exit_app) {
+    if (covers_changed) {
+      covers_changed = false;
+      dirty = true;
+    }
+
     if (!dirty && current_state == STATE_BROWSE) {
-      float target = (float)current_index;
-      float diff = target - anim_pos;
-      if (diff > 0.005f || diff < -0.005f) {
+      if (anim_offset > ANIM_EPSILON || anim_offset < -ANIM_EPSILON) {
         dirty = true;
       } else {
-        anim_pos = target;
+        anim_offset = 0;
       }
     }
 
@@ -559,24 +1308,16 @@ bool coverflow_app(void) {
     }
 
     if (dirty) {
-      lcd_set_viewport(&content_vp);
-      lcd_set_background(LCD_WHITE);
-      lcd_clear_display();
-
       /* Animation step: Slide towards current_index */
-      float target = (float)current_index;
-      float diff = target - anim_pos;
-      if (diff > 0.005f || diff < -0.005f) {
-        anim_pos += diff * 0.2f;
+      if (anim_offset > ANIM_EPSILON || anim_offset < -ANIM_EPSILON) {
+        anim_offset -= anim_offset / 5;
         dirty = true;
       } else {
-        anim_pos = target;
+        anim_offset = 0;
       }
 
-      draw_coverflow_frame();
-
-      /* Update only the content area to prevent vibration */
-      lcd_update_viewport();
+      /* Only the part that changed is redrawn and sent to the LCD */
+      update_coverflow_frame(&content_vp);
       dirty = false;
     }
 
@@ -588,12 +1329,7 @@ bool coverflow_app(void) {
       core_pin(coverflow_mem_handle);
 
       /* Refresh global pointers after repin */
-      unsigned char *re_base =
-          (unsigned char *)core_get_data(coverflow_mem_handle);
-      albums = (struct Album *)re_base;
-      slot_owners = (int *)(re_base + ALBUM_STRUCTS_SIZE);
-      scratch_ptr =
-          re_base + ALBUM_STRUCTS_SIZE + SLOT_OWNERS_SIZE + ALBUM_CACHE_SIZE;
+      refresh_pointers();
       continue;
     }
 
@@ -617,17 +1353,13 @@ bool coverflow_app(void) {
     switch (button) {
     case BUTTON_LEFT:
     case BUTTON_LEFT | BUTTON_REPEAT:
-      if (current_index > 0)
-        current_index--;
-      else
-        current_index = album_count - 1;
+      select_album(current_index > 0 ? current_index - 1 : album_count - 1);
+      loader_request(current_index, -1);
       break;
     case BUTTON_RIGHT:
     case BUTTON_RIGHT | BUTTON_REPEAT:
-      if (current_index < album_count - 1)
-        current_index++;
-      else
-        current_index = 0;
+      select_album(current_index < album_count - 1 ? current_index + 1 : 0);
+      loader_request(current_index, 1);
       break;
     case BUTTON_SELECT:
     case BUTTON_PLAY: {
@@ -635,6 +1367,7 @@ bool coverflow_app(void) {
       strlcpy(path_to_play, albums[current_index].path, MAX_PATH);
 
       /* CRITICAL: Release ALL RAM (Structs + Cache) before Audio starts */
+      loader_stop();
       if (coverflow_mem_handle >= 0) {
         core_unpin(coverflow_mem_handle);
         core_free(coverflow_mem_handle);
@@ -686,6 +1419,7 @@ bool coverflow_app(void) {
   lcd_update();
 
   /* Release all memory if function exits through other ways */
+  loader_stop();
   if (coverflow_mem_handle >= 0) {
     core_unpin(coverflow_mem_handle);
     core_free(coverflow_mem_handle);
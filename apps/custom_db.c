@@ -1,20 +1,191 @@
 #include "custom_db.h"
+#include "core_alloc.h"
 #include "debug.h"
 #include "file.h"
+#include "lru.h"
 #include "system.h"
 #include <string.h>
+#ifdef APPLICATION
+#include <sys/mman.h>
+#endif
 
 /* Global State */
 static int db_fd = -1;
 static struct db_header db_hdr;
 static bool db_initialized = false;
+static bool db_has_ranges = false; /* RDB2 range tables present */
+static bool db_has_prefix = false; /* RDB3 prefix index present */
+static uint32_t db_entry_offset;    /* entry table follows the header */
+
+/* Memory-resident image of the whole file (RAM and MMAP modes) */
+static enum custom_db_load_mode db_mode = CUSTOM_DB_MODE_NONE;
+static int db_mem_handle = -1;
+static unsigned char *db_mem = NULL;
+static size_t db_size = 0;
 
 /* String Buffer */
 #define STR_BUF_SIZE 512
 static char str_buf[STR_BUF_SIZE];
 
+/* Block cache for file-backed lookups. Reads are done in aligned blocks kept
+ * in an LRU list, so consecutive rows of a list hit the same sector instead
+ * of going back to storage for every entry and string. */
+struct db_cache_block {
+  int32_t blockno; /* -1 = empty */
+  unsigned char data[CUSTOM_DB_BLOCK_SIZE];
+};
+
+#define DB_CACHE_SLOT_SIZE (sizeof(struct db_cache_block) + LRU_SLOT_OVERHEAD)
+
+static struct lru db_cache;
+static unsigned char db_cache_buf[CUSTOM_DB_CACHE_BLOCKS * DB_CACHE_SLOT_SIZE]
+    __attribute__((aligned(4)));
+
+static void db_cache_block_init(void *data) {
+  ((struct db_cache_block *)data)->blockno = -1;
+}
+
+static void db_cache_reset(void) {
+  lru_create(&db_cache, db_cache_buf, CUSTOM_DB_CACHE_BLOCKS,
+             sizeof(struct db_cache_block));
+  lru_traverse(&db_cache, db_cache_block_init);
+}
+
+static short db_cache_find(int32_t blockno) {
+  for (short i = 0; i < CUSTOM_DB_CACHE_BLOCKS; i++) {
+    struct db_cache_block *b = lru_data(&db_cache, i);
+    if (b->blockno == blockno)
+      return i;
+  }
+  return -1;
+}
+
+/* Read a run of blocks starting at blockno into the least recently used
+ * slots. Stops early at end of file or at a block that's already cached. */
+static bool db_cache_fill(int32_t blockno, int count) {
+  if (lseek(db_fd, (off_t)blockno * CUSTOM_DB_BLOCK_SIZE, SEEK_SET) < 0)
+    return false;
+
+  for (int i = 0; i < count; i++, blockno++) {
+    if (i > 0 && ((size_t)blockno * CUSTOM_DB_BLOCK_SIZE >= db_size ||
+                  db_cache_find(blockno) >= 0))
+      break;
+
+    short handle = db_cache._head;
+    struct db_cache_block *b = lru_data(&db_cache, handle);
+
+    ssize_t rc = read(db_fd, b->data, CUSTOM_DB_BLOCK_SIZE);
+    if (rc <= 0) {
+      b->blockno = -1;
+      return i > 0;
+    }
+    if (rc < CUSTOM_DB_BLOCK_SIZE)
+      memset(b->data + rc, 0, CUSTOM_DB_BLOCK_SIZE - rc);
+
+    b->blockno = blockno;
+    lru_touch(&db_cache, handle);
+  }
+  return true;
+}
+
+static const unsigned char *db_cache_get(int32_t blockno) {
+  short handle = db_cache_find(blockno);
+
+  if (handle < 0) {
+    /* A miss right after the previous block means the caller is walking
+     * forward through the file; fetch what follows in the same go */
+    int count = (blockno > 0 && db_cache_find(blockno - 1) >= 0)
+                    ? CUSTOM_DB_READAHEAD_BLOCKS
+                    : 1;
+    if (!db_cache_fill(blockno, count))
+      return NULL;
+
+    handle = db_cache_find(blockno);
+    if (handle < 0)
+      return NULL;
+  }
+
+  /* The block just filled (or read ahead) is already at the tail, touching
+   * it again is harmless */
+  lru_touch(&db_cache, handle);
+  return ((struct db_cache_block *)lru_data(&db_cache, handle))->data;
+}
+
+static int db_move_cb(int handle, void *current, void *new) {
+  (void)handle;
+  (void)current;
+  db_mem = new;
+  return BUFLIB_CB_OK;
+}
+
+static struct buflib_callbacks db_ops = {
+    .move_callback = db_move_cb,
+    .shrink_callback = NULL,
+};
+
+#ifdef APPLICATION
+static bool db_map_file(void) {
+  void *p = mmap(NULL, db_size, PROT_READ, MAP_PRIVATE, db_fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+
+  /* Strings are returned in place, so the pool must end on a terminator */
+  if (((const unsigned char *)p)[db_size - 1] != '\0') {
+    munmap(p, db_size);
+    return false;
+  }
+
+  db_mem = p;
+  db_mode = CUSTOM_DB_MODE_MMAP;
+  return true;
+}
+#endif
+
+/* Pull the whole file into a buflib allocation. Only memory that is free
+ * right now is considered so that loading the database never evicts the
+ * audio buffer; if it doesn't fit, lookups stay file-backed. */
+static bool db_load_to_ram(void) {
+  size_t alloc_size = db_size + 1; /* room for a guard terminator */
+
+  if (alloc_size + CUSTOM_DB_RAM_RESERVE > core_allocatable())
+    return false;
+
+  int handle = core_alloc_ex(alloc_size, &db_ops);
+  if (handle <= 0)
+    return false;
+
+  /* The move callback must not fire while we fill the buffer */
+  unsigned char *buf = core_get_data_pinned(handle);
+  bool ok = lseek(db_fd, 0, SEEK_SET) == 0 &&
+            read(db_fd, buf, db_size) == (ssize_t)db_size;
+  buf[db_size] = '\0';
+  core_put_data_pinned(buf);
+
+  if (!ok) {
+    core_free(handle);
+    return false;
+  }
+
+  db_mem_handle = handle;
+  db_mem = core_get_data(handle);
+  db_mode = CUSTOM_DB_MODE_RAM;
+  return true;
+}
+
+static void db_release_mem(void) {
+#ifdef APPLICATION
+  if (db_mode == CUSTOM_DB_MODE_MMAP)
+    munmap(db_mem, db_size);
+#endif
+  if (db_mem_handle > 0)
+    core_free(db_mem_handle);
+
+  db_mem_handle = -1;
+  db_mem = NULL;
+}
+
 bool custom_db_init(void) {
-  if (db_initialized && db_fd >= 0) {
+  if (db_initialized) {
     return true;
   }
 
@@ -25,9 +196,9 @@ bool custom_db_init(void) {
     return false;
   }
 
-  /* Read Header */
-  if (read(db_fd, &db_hdr, sizeof(struct db_header)) !=
-      sizeof(struct db_header)) {
+  /* Read Header: the RDB1 part first, the rest only for RDB2 */
+  memset(&db_hdr, 0, sizeof(db_hdr));
+  if (read(db_fd, &db_hdr, DB_HEADER_V1_SIZE) != DB_HEADER_V1_SIZE) {
     DEBUGF("CustomDB: Failed to read header\n");
     close(db_fd);
     db_fd = -1;
@@ -35,25 +206,91 @@ bool custom_db_init(void) {
   }
 
   /* Magic Check */
-  if (memcmp(db_hdr.magic, DB_MAGIC, 4) != 0) {
+  db_has_prefix = memcmp(db_hdr.magic, DB_MAGIC, 4) == 0;
+  db_has_ranges = db_has_prefix || memcmp(db_hdr.magic, DB_MAGIC_V2, 4) == 0;
+  if (db_has_ranges) {
+    db_entry_offset =
+        db_has_prefix ? sizeof(struct db_header) : DB_HEADER_V2_SIZE;
+    const size_t rest = db_entry_offset - DB_HEADER_V1_SIZE;
+    if (read(db_fd, (char *)&db_hdr + DB_HEADER_V1_SIZE, rest) !=
+        (ssize_t)rest) {
+      DEBUGF("CustomDB: Failed to read header\n");
+      close(db_fd);
+      db_fd = -1;
+      return false;
+    }
+  } else if (memcmp(db_hdr.magic, DB_MAGIC_V1, 4) == 0) {
+    db_entry_offset = DB_HEADER_V1_SIZE;
+  } else {
     DEBUGF("CustomDB: Bad Magic\n");
     close(db_fd);
     db_fd = -1;
     return false;
   }
 
+  db_size = filesize(db_fd);
+  db_mode = CUSTOM_DB_MODE_FILE;
+  db_cache_reset();
+
+  if (db_size > db_entry_offset &&
+      db_hdr.string_pool_offset < db_size) {
+#ifdef APPLICATION
+    if (!db_map_file())
+#endif
+      db_load_to_ram();
+  }
+
+  if (db_mode != CUSTOM_DB_MODE_FILE) {
+    /* Everything is served from memory, the descriptor is no longer needed */
+    close(db_fd);
+    db_fd = -1;
+  }
+
+  DEBUGF("CustomDB: %lu bytes, mode %d\n", (unsigned long)db_size, db_mode);
   db_initialized = true;
   return true;
 }
 
 void custom_db_close(void) {
+  db_release_mem();
   if (db_fd >= 0) {
     close(db_fd);
     db_fd = -1;
   }
+  db_mode = CUSTOM_DB_MODE_NONE;
   db_initialized = false;
 }
 
+enum custom_db_load_mode custom_db_get_load_mode(void) { return db_mode; }
+
+/* Read len bytes at a file offset, from memory when resident and through
+ * the block cache otherwise */
+static bool db_read_at(off_t offset, void *out, size_t len) {
+  if (offset < 0 || (size_t)offset + len > db_size)
+    return false;
+
+  if (db_mem) {
+    memcpy(out, db_mem + offset, len);
+    return true;
+  }
+
+  unsigned char *dst = out;
+  while (len > 0) {
+    const unsigned char *block = db_cache_get(offset / CUSTOM_DB_BLOCK_SIZE);
+    if (!block)
+      return false;
+
+    size_t pos = offset % CUSTOM_DB_BLOCK_SIZE;
+    size_t n = MIN(len, CUSTOM_DB_BLOCK_SIZE - pos);
+    memcpy(dst, block + pos, n);
+
+    dst += n;
+    offset += n;
+    len -= n;
+  }
+  return true;
+}
+
 int custom_db_get_entry_count(void) {
   if (!db_initialized)
     return 0;
@@ -72,15 +309,9 @@ bool custom_db_get_entry(int index, struct db_entry *out) {
   if (index < 0 || (uint32_t)index >= db_hdr.entry_count)
     return false;
 
-  off_t offset = sizeof(struct db_header) + (index * sizeof(struct db_entry));
-
-  if (lseek(db_fd, offset, SEEK_SET) < 0)
-    return false;
-
-  if (read(db_fd, out, sizeof(struct db_entry)) != sizeof(struct db_entry))
-    return false;
+  off_t offset = db_entry_offset + (index * sizeof(struct db_entry));
 
-  return true;
+  return db_read_at(offset, out, sizeof(struct db_entry));
 }
 
 int custom_db_get_artist_start_index(int artist_idx) {
@@ -91,11 +322,8 @@ int custom_db_get_artist_start_index(int artist_idx) {
 
   off_t offset = db_hdr.artist_index_offset + (artist_idx * 4);
 
-  if (lseek(db_fd, offset, SEEK_SET) < 0)
-    return -1;
-
   uint32_t start_index;
-  if (read(db_fd, &start_index, 4) != 4)
+  if (!db_read_at(offset, &start_index, 4))
     return -1;
 
   return (int)start_index;
@@ -115,34 +343,278 @@ int custom_db_get_album_start_index(int album_idx) {
 
   off_t offset = db_hdr.album_index_offset + (album_idx * 4);
 
-  if (lseek(db_fd, offset, SEEK_SET) < 0)
-    return -1;
-
   uint32_t start_index;
-  if (read(db_fd, &start_index, 4) != 4)
+  if (!db_read_at(offset, &start_index, 4))
     return -1;
 
   return (int)start_index;
 }
 
+/* Entry range [start, end) of an artist */
+static bool artist_entry_range(int artist_idx, int *start, int *end) {
+  *start = custom_db_get_artist_start_index(artist_idx);
+  if (*start < 0)
+    return false;
+
+  if ((uint32_t)artist_idx + 1 < db_hdr.artist_count)
+    *end = custom_db_get_artist_start_index(artist_idx + 1);
+  else
+    *end = db_hdr.entry_count;
+
+  return *end >= *start;
+}
+
+/* RDB1: walk the artist's entries counting album changes. Stops at album
+ * want_rel (filling out) or at the end of the artist; returns the number of
+ * albums seen. */
+static int scan_artist_albums(int artist_idx, int want_rel,
+                              struct db_album_range *out) {
+  int start, end;
+  if (!artist_entry_range(artist_idx, &start, &end))
+    return 0;
+
+  struct db_entry entry;
+  uint32_t last_album_idx = (uint32_t)-1;
+  int album_count = 0;
+
+  for (int i = start; i < end; i++) {
+    if (!custom_db_get_entry(i, &entry))
+      break;
+
+    if (entry.album_idx != last_album_idx) {
+      if (out && album_count == want_rel + 1) {
+        out->track_count = i - out->start_entry;
+        return album_count;
+      }
+      if (out && album_count == want_rel) {
+        out->start_entry = i;
+        out->album_idx = entry.album_idx;
+      }
+      album_count++;
+      last_album_idx = entry.album_idx;
+    }
+  }
+
+  if (out && album_count == want_rel + 1)
+    out->track_count = end - out->start_entry;
+
+  return album_count;
+}
+
+int custom_db_get_artist_album_count(int artist_idx) {
+  if (!db_initialized)
+    return 0;
+  if (artist_idx < 0 || (uint32_t)artist_idx >= db_hdr.artist_count)
+    return 0;
+
+  if (!db_has_ranges)
+    return scan_artist_albums(artist_idx, -1, NULL);
+
+  uint32_t first[2];
+  off_t offset = db_hdr.artist_group_offset + (artist_idx * 4);
+  if (!db_read_at(offset, first, sizeof(first)) || first[1] < first[0])
+    return 0;
+
+  return first[1] - first[0];
+}
+
+bool custom_db_get_artist_album(int artist_idx, int album_rel_idx,
+                                struct db_album_range *out) {
+  if (!db_initialized)
+    return false;
+  if (artist_idx < 0 || (uint32_t)artist_idx >= db_hdr.artist_count ||
+      album_rel_idx < 0)
+    return false;
+
+  if (!db_has_ranges)
+    return scan_artist_albums(artist_idx, album_rel_idx, out) > album_rel_idx;
+
+  uint32_t first[2];
+  off_t offset = db_hdr.artist_group_offset + (artist_idx * 4);
+  if (!db_read_at(offset, first, sizeof(first)))
+    return false;
+
+  uint32_t group = first[0] + album_rel_idx;
+  if (group >= first[1] || group >= db_hdr.group_count)
+    return false;
+
+  offset = db_hdr.group_table_offset + group * sizeof(struct db_album_range);
+  return db_read_at(offset, out, sizeof(struct db_album_range));
+}
+
+bool custom_db_get_album(int album_idx, struct db_album_range *out) {
+  if (!db_initialized)
+    return false;
+  if (album_idx < 0 || (uint32_t)album_idx >= db_hdr.album_count)
+    return false;
+
+  if (db_has_ranges) {
+    off_t offset =
+        db_hdr.album_table_offset + album_idx * sizeof(struct db_album_range);
+    return db_read_at(offset, out, sizeof(struct db_album_range));
+  }
+
+  int start = custom_db_get_album_start_index(album_idx);
+  int end;
+  if ((uint32_t)album_idx + 1 < db_hdr.album_count)
+    end = custom_db_get_album_start_index(album_idx + 1);
+  else
+    end = db_hdr.entry_count;
+
+  struct db_entry entry;
+  if (start < 0 || end < start || !custom_db_get_entry(start, &entry))
+    return false;
+
+  out->start_entry = start;
+  out->track_count = end - start;
+  out->album_idx = entry.album_idx;
+  return true;
+}
+
+bool custom_db_has_prefix_index(void) {
+  return db_initialized && db_has_prefix;
+}
+
+/* Prefix table and row count of a list */
+static bool prefix_table(enum custom_db_key key, uint32_t *offset,
+                         uint32_t *count) {
+  switch (key) {
+  case CUSTOM_DB_KEY_ARTIST:
+    *offset = db_hdr.artist_prefix_offset;
+    *count = db_hdr.artist_count;
+    return true;
+  case CUSTOM_DB_KEY_ALBUM:
+    *offset = db_hdr.album_prefix_offset;
+    *count = db_hdr.album_count;
+    return true;
+  case CUSTOM_DB_KEY_TITLE:
+    *offset = db_hdr.title_prefix_offset;
+    *count = db_hdr.entry_count;
+    return true;
+  }
+  return false;
+}
+
+static bool get_prefix_row(enum custom_db_key key, int pos,
+                           struct db_prefix *row) {
+  uint32_t offset, count;
+  if (!prefix_table(key, &offset, &count) || pos < 0 ||
+      (uint32_t)pos >= count)
+    return false;
+
+  return db_read_at(offset + pos * sizeof(struct db_prefix), row,
+                    sizeof(struct db_prefix));
+}
+
+int custom_db_get_sorted_item(enum custom_db_key key, int pos) {
+  if (!db_initialized)
+    return -1;
+
+  if (!db_has_prefix) {
+    uint32_t offset, count;
+    if (!prefix_table(key, &offset, &count) || pos < 0 ||
+        (uint32_t)pos >= count)
+      return -1;
+    return pos;
+  }
+
+  struct db_prefix row;
+  if (!get_prefix_row(key, pos, &row))
+    return -1;
+  return row.item;
+}
+
+static inline unsigned char fold_ascii(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* Sign of (row name) - (folded prefix) over the length of the prefix */
+static int prefix_cmp(const struct db_prefix *row, const unsigned char *fp,
+                      size_t len) {
+  int rc = memcmp(row->key, fp, MIN(len, DB_PREFIX_LEN));
+  if (rc || len <= DB_PREFIX_LEN)
+    return rc;
+
+  /* Same first DB_PREFIX_LEN bytes, only the full name can tell */
+  const unsigned char *name =
+      (const unsigned char *)custom_db_get_string(row->name_idx);
+  for (size_t i = DB_PREFIX_LEN; i < len; i++) {
+    unsigned char c = fold_ascii(name[i]);
+    if (c != fp[i])
+      return c < fp[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+int custom_db_find_prefix(enum custom_db_key key, const char *prefix) {
+  uint32_t offset, count;
+  if (!db_initialized || !db_has_prefix ||
+      !prefix_table(key, &offset, &count) || count == 0)
+    return -1;
+
+  unsigned char fp[STR_BUF_SIZE];
+  size_t len = 0;
+  while (prefix[len] && len < sizeof(fp)) {
+    fp[len] = fold_ascii(prefix[len]);
+    len++;
+  }
+
+  /* Lower bound: first row not sorting before the prefix */
+  uint32_t lo = 0, hi = count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    struct db_prefix row;
+    if (!get_prefix_row(key, mid, &row))
+      return -1;
+
+    if (prefix_cmp(&row, fp, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo < count ? (int)lo : (int)count - 1;
+}
+
 const char *custom_db_get_string(uint32_t offset) {
   if (!db_initialized)
     return "<DB Error>";
 
   off_t abs_offset = db_hdr.string_pool_offset + offset;
 
-  if (lseek(db_fd, abs_offset, SEEK_SET) < 0)
-    return "<Seek Error>";
-
-  int read_bytes = read(db_fd, str_buf, STR_BUF_SIZE - 1);
-  if (read_bytes < 0)
-    return "<Read Error>";
+  if (db_mem) {
+    /* Resident: the pool is NUL terminated, hand out the string in place */
+    if ((size_t)abs_offset >= db_size)
+      return "<Seek Error>";
+    return (const char *)db_mem + abs_offset;
+  }
 
-  str_buf[read_bytes] = '\0';
+  /* Copy block by block up to the terminator; longer strings get truncated
+   * to str_buf */
+  size_t len = 0;
+  while (len < STR_BUF_SIZE - 1 && (size_t)abs_offset < db_size) {
+    const unsigned char *block =
+        db_cache_get(abs_offset / CUSTOM_DB_BLOCK_SIZE);
+    if (!block)
+      return len ? str_buf : "<Read Error>";
+
+    size_t pos = abs_offset % CUSTOM_DB_BLOCK_SIZE;
+    size_t n = MIN(STR_BUF_SIZE - 1 - len, CUSTOM_DB_BLOCK_SIZE - pos);
+    const unsigned char *nul = memchr(block + pos, '\0', n);
+    if (nul)
+      n = nul - (block + pos);
+
+    memcpy(str_buf + len, block + pos, n);
+    len += n;
+    abs_offset += n;
+
+    if (nul)
+      break;
+  }
 
-  /* Naive string reading: assuming it fits in buffer and null terminator is
-   * present */
-  /* If the string is longer, it will just get truncated by str_buf size */
+  if (len == 0 && (size_t)abs_offset >= db_size)
+    return "<Seek Error>";
 
+  str_buf[len] = '\0';
   return str_buf;
 }
@@ -2,12 +2,36 @@
 #define _CUSTOM_DB_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Database location */
 #define CUSTOM_DB_PATH "/database.rdb"
 
-#define DB_MAGIC "RDB1"
+#define DB_MAGIC "RDB3"
+#define DB_MAGIC_V2 "RDB2" /* still readable, without the prefix index */
+#define DB_MAGIC_V1 "RDB1" /* ...and without the range tables */
+
+/* Bytes of the case-folded name kept in each prefix index row */
+#define DB_PREFIX_LEN 8
+
+/* Free RAM to leave untouched when deciding whether the database can be
+ * held in memory */
+#define CUSTOM_DB_RAM_RESERVE (64 * 1024)
+
+/* File-backed mode: blocks of the file kept in an LRU cache, and how many
+ * blocks to fetch at once when a list is walked sequentially */
+#define CUSTOM_DB_BLOCK_SIZE 512
+#define CUSTOM_DB_CACHE_BLOCKS 32
+#define CUSTOM_DB_READAHEAD_BLOCKS 8
+
+/* Where lookups are served from */
+enum custom_db_load_mode {
+  CUSTOM_DB_MODE_NONE = 0, /* not initialised */
+  CUSTOM_DB_MODE_FILE,     /* read through the block cache */
+  CUSTOM_DB_MODE_RAM,      /* whole file loaded into a buflib allocation */
+  CUSTOM_DB_MODE_MMAP,     /* whole file mapped read-only (hosted builds) */
+};
 
 struct db_header {
   char magic[4];
@@ -17,8 +41,23 @@ struct db_header {
   uint32_t artist_index_offset;
   uint32_t album_index_offset;
   uint32_t string_pool_offset;
+  /* RDB2 only. A "group" is a run of entries sharing artist and album,
+   * i.e. one album as shown under an artist. */
+  uint32_t group_count;
+  uint32_t artist_group_offset; /* uint32_t[artist_count + 1], first group */
+  uint32_t group_table_offset;  /* struct db_album_range[group_count] */
+  uint32_t album_table_offset;  /* struct db_album_range[album_count] */
+  /* RDB3 only. Alphabetical indices, struct db_prefix[artist_count],
+   * [album_count] and [entry_count] */
+  uint32_t artist_prefix_offset;
+  uint32_t album_prefix_offset;
+  uint32_t title_prefix_offset;
 } __attribute__((packed));
 
+/* Size of the header written by RDB1 and RDB2 files */
+#define DB_HEADER_V1_SIZE offsetof(struct db_header, group_count)
+#define DB_HEADER_V2_SIZE offsetof(struct db_header, artist_prefix_offset)
+
 struct db_entry {
   uint32_t title_idx;
   uint32_t artist_idx;
@@ -26,6 +65,29 @@ struct db_entry {
   uint32_t path_idx;
 } __attribute__((packed));
 
+/* Track range of one album */
+struct db_album_range {
+  uint32_t start_entry;
+  uint32_t track_count;
+  uint32_t album_idx; /* string pool offset of the album name */
+} __attribute__((packed));
+
+/* Prefix index row. Rows are sorted by name with ASCII letters folded to
+ * lower case and compared bytewise (the order of strcasecmp()), then by
+ * item. */
+struct db_prefix {
+  char key[DB_PREFIX_LEN]; /* folded name, NUL padded, not terminated */
+  uint32_t item;           /* artist, album or entry index */
+  uint32_t name_idx;       /* string pool offset of the name */
+} __attribute__((packed));
+
+/* Lists that have a prefix index */
+enum custom_db_key {
+  CUSTOM_DB_KEY_ARTIST = 0,
+  CUSTOM_DB_KEY_ALBUM,
+  CUSTOM_DB_KEY_TITLE,
+};
+
 /* API */
 bool custom_db_init(void);
 void custom_db_close(void);
@@ -33,8 +95,12 @@ int custom_db_get_entry_count(void);
 int custom_db_get_artist_count(void);
 int custom_db_get_album_count(void);
 int custom_db_get_album_start_index(int album_idx);
+enum custom_db_load_mode custom_db_get_load_mode(void);
 
-/* Fills generic buffer with string */
+/* Returns a NUL terminated string. When the database is memory resident this
+ * points straight into the string pool; otherwise it is a shared buffer that
+ * the next call overwrites. Either way, don't keep it across core_alloc() or
+ * custom_db_close(). */
 const char *custom_db_get_string(uint32_t offset);
 
 /* Fills entry struct */
@@ -43,4 +109,25 @@ bool custom_db_get_entry(int index, struct db_entry *out);
 /* Get the start entry index for a given artist index */
 int custom_db_get_artist_start_index(int artist_idx);
 
+/* Albums of one artist, and the track range of the n-th of them. O(1) with
+ * RDB2; RDB1 files fall back to scanning the artist's entries. */
+int custom_db_get_artist_album_count(int artist_idx);
+bool custom_db_get_artist_album(int artist_idx, int album_rel_idx,
+                                struct db_album_range *out);
+
+/* Track range of an album from the global album list */
+bool custom_db_get_album(int album_idx, struct db_album_range *out);
+
+/* Alphabetical lists: the artist, album or entry index at position pos.
+ * Without a prefix index (RDB1/RDB2) this is pos itself, which for artists
+ * is already alphabetical. Returns -1 when out of range. */
+bool custom_db_has_prefix_index(void);
+int custom_db_get_sorted_item(enum custom_db_key key, int pos);
+
+/* Type-to-jump: position in the alphabetical list of the first name that
+ * sorts at or after prefix, ignoring ASCII case. A binary search over the
+ * index; the string pool is only read when prefix is longer than
+ * DB_PREFIX_LEN. Returns -1 without a prefix index or for an empty list. */
+int custom_db_find_prefix(enum custom_db_key key, const char *prefix);
+
 #endif
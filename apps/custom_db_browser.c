@@ -1,8 +1,10 @@
 #include "custom_db_browser.h"
 #include "action.h"
 #include "custom_db.h"
+#include "custom_db_builder.h"
 #include "debug.h"
 #include "icons.h"
+#include "keyboard.h"
 #include "kernel.h"
 #include "lang.h"
 #include "list.h"
@@ -13,6 +15,8 @@
 #include "splash.h"
 #include "string.h"
 #include "system.h"
+#include "yesno.h"
+#include <stdio.h>
 
 /* Browser State */
 enum browser_view {
@@ -23,7 +27,8 @@ enum browser_view {
   VIEW_ALL_ALBUMS,          /* Global list of albums */
   VIEW_ALL_TRACKS,          /* Global list of tracks */
   VIEW_ALBUM_CONTEXT,       /* Context menu for an album */
-  VIEW_GLOBAL_ALBUM_CONTEXT /* Context menu for a global album */
+  VIEW_GLOBAL_ALBUM_CONTEXT, /* Context menu for a global album */
+  VIEW_JUMP                  /* Letter picker / search for a list */
 };
 
 struct browser_context {
@@ -31,10 +36,9 @@ struct browser_context {
   int artist_idx;
   int album_idx_rel; /* Relative album index within artist */
   int selected_item;
-
-  /* Cache for Album View (Artist) */
-  int current_artist_start_entry;
-  int current_artist_end_entry;
+  int album_pos;                /* Position in the global album list */
+  enum browser_view jump_from;  /* List the letter picker jumps in */
+  int jump_from_item;
 
   /* Cache for Track View */
   int current_album_start_entry;
@@ -44,84 +48,58 @@ struct browser_context {
 static struct browser_context ctx;
 static struct gui_synclist db_list;
 
-/* Helper: Find Album Range */
-static void find_album_range(int artist_start, int artist_end,
-                             int album_rel_idx, int *out_start, int *out_end) {
-  struct db_entry entry;
-  int current_entry = artist_start;
-  int album_count = 0;
-
-  *out_start = -1;
-  *out_end = -1;
-
-  uint32_t last_album_idx = (uint32_t)-1;
-
-  while (current_entry < artist_end) {
-    if (!custom_db_get_entry(current_entry, &entry))
-      break;
+/* Builder generation of the database currently open */
+static int db_generation;
+/* Builds that have ended and been reported to the user */
+static int db_finished;
 
-    if (entry.album_idx != last_album_idx) {
-      if (album_count == album_rel_idx) {
-        *out_start = current_entry;
-      } else if (album_count == album_rel_idx + 1) {
-        /* Found start of next album, so prev album ended at current_entry */
-        *out_end = current_entry;
-        return;
-      }
-      album_count++;
-      last_album_idx = entry.album_idx;
-    }
-    current_entry++;
-  }
-
-  if (*out_start != -1 && *out_end == -1) {
-    *out_end = artist_end;
-  }
-}
-
-/* Helper: Get Album Name */
-static const char *get_album_name_str(int artist_start, int artist_end,
-                                      int album_rel_idx) {
-  struct db_entry entry;
-  int current_entry = artist_start;
-  int album_count = 0;
-
-  uint32_t last_album_idx = (uint32_t)-1;
-
-  while (current_entry < artist_end) {
-    if (!custom_db_get_entry(current_entry, &entry))
-      break;
+static struct custom_db_enqueue_stat enqueue_stat;
 
-    if (entry.album_idx != last_album_idx) {
-      if (album_count == album_rel_idx) {
-        return custom_db_get_string(entry.album_idx);
-      }
-      album_count++;
-      last_album_idx = entry.album_idx;
-    }
-    current_entry++;
-  }
-  return "<Unknown Album>";
+/* Helper: Select the track range of an album for the track view */
+static void set_album_range(const struct db_album_range *range) {
+  ctx.current_album_start_entry = range->start_entry;
+  ctx.current_album_end_entry = range->start_entry + range->track_count;
 }
 
 /* Main Menu Options */
-enum { MENU_ARTIST = 0, MENU_ALBUM, MENU_TRACK, MENU_COUNT };
+enum { MENU_ARTIST = 0, MENU_ALBUM, MENU_TRACK, MENU_UPDATE, MENU_COUNT };
 
-static const char *main_menu_items[] = {"Artists", "Albums", "Tracks"};
+static const char *main_menu_items[] = {"Artists", "Albums", "Tracks",
+                                        "Update Database"};
 
 /* Album Context Menu Options */
 enum { ALBUM_CTX_PLAY = 0, ALBUM_CTX_VIEW, ALBUM_CTX_COUNT };
 
 static const char *album_ctx_items[] = {"Play Album", "View Tracks"};
 
+/* Letter picker: search, then '#' (anything before 'A'), then A-Z */
+enum { JUMP_SEARCH = 0, JUMP_OTHER, JUMP_FIRST_LETTER, JUMP_COUNT = 28 };
+
+/* Artists are stored alphabetically; the global album and track lists are
+ * shown in the order of the database's prefix index */
+static enum custom_db_key jump_key(enum browser_view view) {
+  if (view == VIEW_ALL_ALBUMS)
+    return CUSTOM_DB_KEY_ALBUM;
+  if (view == VIEW_ALL_TRACKS)
+    return CUSTOM_DB_KEY_TITLE;
+  return CUSTOM_DB_KEY_ARTIST;
+}
+
 /* List Callbacks */
 static const char *db_browser_get_name(int selected_item, void *data,
                                        char *buffer, size_t buffer_len) {
   (void)data;
-  (void)buffer;
-  (void)buffer_len; /* Use static buffer from custom_db or copy */
 
   if (ctx.view == VIEW_MAIN_MENU) {
+    if (selected_item == MENU_UPDATE) {
+      struct custom_db_build_status st;
+      custom_db_builder_get_status(&st);
+      if (st.running) {
+        snprintf(buffer, buffer_len, "Updating Database (%d/%d)",
+                 st.files_done, st.files_found);
+        return buffer;
+      }
+    }
     if (selected_item >= 0 && selected_item < MENU_COUNT)
       return main_menu_items[selected_item];
     return "";
@@ -130,6 +108,14 @@ static const char *db_browser_get_name(int selected_item, void *data,
     if (selected_item >= 0 && selected_item < ALBUM_CTX_COUNT)
       return album_ctx_items[selected_item];
     return "";
+  } else if (ctx.view == VIEW_JUMP) {
+    if (selected_item == JUMP_SEARCH)
+      return "Search...";
+    if (selected_item == JUMP_OTHER)
+      return "#";
+    snprintf(buffer, buffer_len, "%c",
+             'A' + selected_item - JUMP_FIRST_LETTER);
+    return buffer;
   } else if (ctx.view == VIEW_ARTIST_LIST) {
     int start_entry = custom_db_get_artist_start_index(selected_item);
     if (start_entry < 0)
@@ -141,8 +127,10 @@ static const char *db_browser_get_name(int selected_item, void *data,
 
     return custom_db_get_string(entry.artist_idx);
   } else if (ctx.view == VIEW_ALBUM_LIST) {
-    return get_album_name_str(ctx.current_artist_start_entry,
-                              ctx.current_artist_end_entry, selected_item);
+    struct db_album_range range;
+    if (!custom_db_get_artist_album(ctx.artist_idx, selected_item, &range))
+      return "<Unknown Album>";
+    return custom_db_get_string(range.album_idx);
   } else if (ctx.view == VIEW_TRACK_LIST) {
     int entry_idx = ctx.current_album_start_entry + selected_item;
     struct db_entry entry;
@@ -150,14 +138,17 @@ static const char *db_browser_get_name(int selected_item, void *data,
       return "<Entry Error>";
     return custom_db_get_string(entry.title_idx);
   } else if (ctx.view == VIEW_ALL_ALBUMS) {
-    int start_entry = custom_db_get_album_start_index(selected_item);
-    struct db_entry entry;
-    if (!custom_db_get_entry(start_entry, &entry))
+    struct db_album_range range;
+    int album_idx =
+        custom_db_get_sorted_item(CUSTOM_DB_KEY_ALBUM, selected_item);
+    if (!custom_db_get_album(album_idx, &range))
       return "<Entry Error>";
-    return custom_db_get_string(entry.album_idx);
+    return custom_db_get_string(range.album_idx);
   } else if (ctx.view == VIEW_ALL_TRACKS) {
     struct db_entry entry;
-    if (!custom_db_get_entry(selected_item, &entry))
+    int entry_idx =
+        custom_db_get_sorted_item(CUSTOM_DB_KEY_TITLE, selected_item);
+    if (!custom_db_get_entry(entry_idx, &entry))
       return "<Entry Error>";
     return custom_db_get_string(entry.title_idx);
   }
@@ -170,16 +161,29 @@ static int play_tracks(int start_entry, int end_entry,
   /* Create new dynamic playlist (Refreshes current playlist completely) */
   playlist_create(NULL, NULL);
 
-  struct playlist_info *pl = playlist_get_current();
+  /* One insert context for the whole range: the playlist is locked and the
+   * control file synced once instead of per track. Entries and paths are
+   * read in file order, so the block cache streams through them. */
+  struct playlist_insert_context pl_ctx;
+  long start_tick = current_tick;
+  int added = 0;
 
-  struct db_entry entry;
-  for (int i = start_entry; i < end_entry; i++) {
-    if (custom_db_get_entry(i, &entry)) {
-      const char *path = custom_db_get_string(entry.path_idx);
-      /* Important: queue=false, sync=false to build playlist first */
-      playlist_insert_track(pl, path, PLAYLIST_INSERT_LAST, false, false);
+  cpu_boost(true);
+  if (playlist_insert_context_create(NULL, &pl_ctx, PLAYLIST_INSERT_LAST,
+                                     false, false) >= 0) {
+    struct db_entry entry;
+    for (int i = start_entry; i < end_entry; i++) {
+      if (custom_db_get_entry(i, &entry) &&
+          playlist_insert_context_add(
+              &pl_ctx, custom_db_get_string(entry.path_idx)) >= 0)
+        added++;
     }
   }
+  playlist_insert_context_release(&pl_ctx);
+  cpu_boost(false);
+
+  enqueue_stat.tracks = added;
+  enqueue_stat.ticks = current_tick - start_tick;
 
   if (playlist_amount() > 0) {
     playlist_start(start_index_relative, 0, 0);
@@ -189,13 +193,96 @@ static int play_tracks(int start_entry, int end_entry,
   return GO_TO_ROOT;
 }
 
+/* Helper: Jump in the list the picker was opened from. Returns false if the
+ * user backed out of the keyboard. */
+static bool jump_to(int picked) {
+  char prefix[64] = "";
+
+  if (picked == JUMP_SEARCH) {
+    if (kbd_input(prefix, sizeof(prefix), NULL) < 0 || !prefix[0])
+      return false;
+  } else if (picked >= JUMP_FIRST_LETTER) {
+    prefix[0] = 'A' + picked - JUMP_FIRST_LETTER;
+    prefix[1] = '\0';
+  }
+
+  int pos = 0;
+  if (prefix[0]) {
+    pos = custom_db_find_prefix(jump_key(ctx.jump_from), prefix);
+    if (pos < 0) {
+      splash(HZ * 2, "Update Database to enable search");
+      pos = ctx.jump_from_item;
+    }
+  }
+
+  ctx.view = ctx.jump_from;
+  ctx.selected_item = pos;
+  return true;
+}
+
+/* Helper: Kick off a background rebuild */
+static void start_update(void) {
+  if (custom_db_builder_start())
+    splash(HZ, "Updating database in background");
+  else
+    splash(HZ, "Update already running");
+}
+
+/* Helper: Reopen the database once the builder has installed a new one.
+ * Only done from the main menu, where no indices are held. */
+static bool reload_if_updated(void) {
+  struct custom_db_build_status st;
+  custom_db_builder_get_status(&st);
+  if (st.running)
+    return true;
+
+  /* The builder thread can't splash; failures are reported here */
+  if (st.finished != db_finished) {
+    const char *error = custom_db_builder_error_str(st.result);
+    db_finished = st.finished;
+    if (error)
+      splash(HZ * 2, error);
+  }
+
+  if (st.generation == db_generation)
+    return true;
+
+  custom_db_close();
+  db_generation = st.generation;
+  if (!custom_db_init())
+    return false;
+
+  splashf(HZ, "Database updated: %d tracks", custom_db_get_entry_count());
+  return true;
+}
+
+void custom_db_browser_get_enqueue_stat(struct custom_db_enqueue_stat *out) {
+  *out = enqueue_stat;
+}
+
 int custom_db_browser_main(void *param) {
   (void)param;
   bool exit_browser = false;
   int ret_val = GO_TO_ROOT;
 
+  struct custom_db_build_status st;
+  custom_db_builder_get_status(&st);
+  db_generation = st.generation;
+
   if (!custom_db_init()) {
-    splash(HZ * 2, "DB Init Failed");
+    if (st.running) {
+      splash(HZ * 2, "Database is being built");
+    } else {
+      const char *error = custom_db_builder_error_str(st.result);
+      if (error && st.finished != db_finished)
+        splash(HZ * 2, error);
+      db_finished = st.finished;
+
+      static const char *lines[] = {"No database", "Build it now?"};
+      static const struct text_message message = {lines, 2};
+      if (gui_syncyesno_run(&message, NULL, NULL) == YESNO_YES)
+        start_update();
+    }
     return GO_TO_ROOT;
   }
 
@@ -210,12 +297,19 @@ int custom_db_browser_main(void *param) {
     const char *title = "Database";
 
     if (ctx.view == VIEW_MAIN_MENU) {
+      if (!reload_if_updated()) {
+        splash(HZ * 2, "DB Init Failed");
+        break;
+      }
       count = MENU_COUNT;
       title = "Database";
     } else if (ctx.view == VIEW_ALBUM_CONTEXT ||
                ctx.view == VIEW_GLOBAL_ALBUM_CONTEXT) {
       count = ALBUM_CTX_COUNT;
       title = "Album Options";
+    } else if (ctx.view == VIEW_JUMP) {
+      count = JUMP_COUNT;
+      title = "Jump To";
     } else if (ctx.view == VIEW_ARTIST_LIST) {
       count = custom_db_get_artist_count();
       title = "Artists";
@@ -226,43 +320,10 @@ int custom_db_browser_main(void *param) {
       count = custom_db_get_entry_count();
       title = "All Tracks";
     } else if (ctx.view == VIEW_ALBUM_LIST) {
-      /* Count albums for artist */
-      ctx.current_artist_start_entry =
-          custom_db_get_artist_start_index(ctx.artist_idx);
-      /* Find end entry */
-      if (ctx.artist_idx + 1 < custom_db_get_artist_count())
-        ctx.current_artist_end_entry =
-            custom_db_get_artist_start_index(ctx.artist_idx + 1);
-      else
-        ctx.current_artist_end_entry = custom_db_get_entry_count();
-
-      /* Iterate to count albums */
-      struct db_entry entry;
-      int curr = ctx.current_artist_start_entry;
-      uint32_t last_album = (uint32_t)-1;
-      count = 0;
-      while (curr < ctx.current_artist_end_entry) {
-        if (custom_db_get_entry(curr, &entry)) {
-          if (entry.album_idx != last_album) {
-            count++;
-            last_album = entry.album_idx;
-          }
-        }
-        curr++;
-      }
-
+      count = custom_db_get_artist_album_count(ctx.artist_idx);
       title = "Albums";
     } else if (ctx.view == VIEW_TRACK_LIST) {
-      if (ctx.artist_idx == -1) {
-        /* Global Album Mode: range already set in VIEW_ALL_ALBUMS/CTX logic, do
-         * nothing */
-      } else {
-        /* Artist Mode: Recalculate range just in case */
-        find_album_range(ctx.current_artist_start_entry,
-                         ctx.current_artist_end_entry, ctx.album_idx_rel,
-                         &ctx.current_album_start_entry,
-                         &ctx.current_album_end_entry);
-      }
+      /* Range was set when the album was picked */
       count = ctx.current_album_end_entry - ctx.current_album_start_entry;
       title = "Tracks";
     }
@@ -293,29 +354,26 @@ int custom_db_browser_main(void *param) {
         } else if (ctx.selected_item == MENU_TRACK) {
           ctx.view = VIEW_ALL_TRACKS;
           ctx.selected_item = 0;
+        } else if (ctx.selected_item == MENU_UPDATE) {
+          start_update();
         }
       } else if (ctx.view == VIEW_ARTIST_LIST) {
         ctx.artist_idx = ctx.selected_item;
         ctx.view = VIEW_ALBUM_LIST;
         ctx.selected_item = 0;
       } else if (ctx.view == VIEW_ALBUM_LIST) {
+        struct db_album_range range;
+        if (!custom_db_get_artist_album(ctx.artist_idx, ctx.selected_item,
+                                        &range))
+          break;
+        set_album_range(&range);
         ctx.album_idx_rel = ctx.selected_item;
         ctx.view = VIEW_ALBUM_CONTEXT;
         ctx.selected_item = 0;
       } else if (ctx.view == VIEW_ALBUM_CONTEXT ||
                  ctx.view == VIEW_GLOBAL_ALBUM_CONTEXT) {
         if (ctx.selected_item == ALBUM_CTX_PLAY) {
-          /* Play Album */
-
-          /* If Artist Context, we need to find range. If Global, range is
-           * already valid in cache. */
-          if (ctx.view == VIEW_ALBUM_CONTEXT) {
-            find_album_range(ctx.current_artist_start_entry,
-                             ctx.current_artist_end_entry, ctx.album_idx_rel,
-                             &ctx.current_album_start_entry,
-                             &ctx.current_album_end_entry);
-          }
-
+          /* Play Album: range is already valid in the cache */
           ret_val = play_tracks(ctx.current_album_start_entry,
                                 ctx.current_album_end_entry, 0);
           exit_browser = true;
@@ -325,17 +383,18 @@ int custom_db_browser_main(void *param) {
           ctx.view = VIEW_TRACK_LIST;
           ctx.selected_item = 0;
         }
+      } else if (ctx.view == VIEW_JUMP) {
+        if (!jump_to(ctx.selected_item))
+          ctx.selected_item = JUMP_SEARCH;
       } else if (ctx.view == VIEW_ALL_ALBUMS) {
         /* Global Album Selected -> Go to Global Context */
-        int start_entry = custom_db_get_album_start_index(ctx.selected_item);
-        int end_entry;
-        if (ctx.selected_item + 1 < custom_db_get_album_count())
-          end_entry = custom_db_get_album_start_index(ctx.selected_item + 1);
-        else
-          end_entry = custom_db_get_entry_count();
-
-        ctx.current_album_start_entry = start_entry;
-        ctx.current_album_end_entry = end_entry;
+        struct db_album_range range;
+        int album_idx =
+            custom_db_get_sorted_item(CUSTOM_DB_KEY_ALBUM, ctx.selected_item);
+        if (!custom_db_get_album(album_idx, &range))
+          break;
+        set_album_range(&range);
+        ctx.album_pos = ctx.selected_item;
 
         /* Mark as global context by setting artist_idx -1 and switching view */
         ctx.artist_idx = -1;
@@ -349,11 +408,24 @@ int custom_db_browser_main(void *param) {
         exit_browser = true;
       } else if (ctx.view == VIEW_ALL_TRACKS) {
         /* Play single track */
-        ret_val = play_tracks(ctx.selected_item, ctx.selected_item + 1, 0);
+        int entry_idx =
+            custom_db_get_sorted_item(CUSTOM_DB_KEY_TITLE, ctx.selected_item);
+        ret_val = play_tracks(entry_idx, entry_idx + 1, 0);
         exit_browser = true;
       }
       break;
 
+    case ACTION_STD_CONTEXT:
+      /* Letter picker for the long lists */
+      if (ctx.view == VIEW_ARTIST_LIST || ctx.view == VIEW_ALL_ALBUMS ||
+          ctx.view == VIEW_ALL_TRACKS) {
+        ctx.jump_from = ctx.view;
+        ctx.jump_from_item = gui_synclist_get_sel_pos(&db_list);
+        ctx.view = VIEW_JUMP;
+        ctx.selected_item = 0;
+      }
+      break;
+
     case ACTION_STD_CANCEL:
       if (ctx.view == VIEW_TRACK_LIST) {
         if (ctx.artist_idx == -1) {
@@ -370,11 +442,10 @@ int custom_db_browser_main(void *param) {
         ctx.selected_item = ctx.album_idx_rel;
       } else if (ctx.view == VIEW_GLOBAL_ALBUM_CONTEXT) {
         ctx.view = VIEW_ALL_ALBUMS;
-        /* Recover global album index? We don't track cached global album
-         * selection well. */
-        /* Need to store global album idx somewhere or infer? */
-        /* Let's reset to 0 for now. */
-        ctx.selected_item = 0;
+        ctx.selected_item = ctx.album_pos;
+      } else if (ctx.view == VIEW_JUMP) {
+        ctx.view = ctx.jump_from;
+        ctx.selected_item = ctx.jump_from_item;
       } else if (ctx.view == VIEW_ALBUM_LIST) {
         ctx.view = VIEW_ARTIST_LIST;
         ctx.selected_item = ctx.artist_idx;
@@ -390,5 +461,8 @@ int custom_db_browser_main(void *param) {
     }
   }
 
+  /* Give the resident copy back so playback can have the RAM */
+  custom_db_close();
+
   return ret_val;
 }
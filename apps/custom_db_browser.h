@@ -6,4 +6,12 @@
 /* Main entry point for the custom database browser */
 int custom_db_browser_main(void *param);
 
+/* Last album/track selection sent to the playlist, for the debug menu */
+struct custom_db_enqueue_stat {
+  int tracks;
+  long ticks;
+};
+
+void custom_db_browser_get_enqueue_stat(struct custom_db_enqueue_stat *out);
+
 #endif
@@ -0,0 +1,903 @@
+#include "custom_db_builder.h"
+#include "core_alloc.h"
+#include "debug.h"
+#include "dir.h"
+#include "file.h"
+#include "kernel.h"
+#include "logf.h"
+#include "metadata.h"
+#include "misc.h"
+#include "settings.h"
+#include "string-extra.h"
+#include "system.h"
+#include "thread.h"
+#include "usb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* On-device generator for CUSTOM_DB_PATH. Produces the same file as
+ * pc_app/modules/db_generator.js and tools/rdbgen for the same tags.
+ *
+ * All files are listed first, then matched against the manifest of the
+ * previous build; only files that are new or whose size/mtime changed go
+ * through get_metadata(). The result is written next to the database and
+ * renamed over it, so readers see either the old or the new file. */
+
+#define DB_TEMP_PATH CUSTOM_DB_PATH ".tmp"
+#define MANIFEST_TEMP_PATH CUSTOM_DB_MANIFEST_PATH ".tmp"
+
+/* The work buffer starts at this size and grows by half when full, but
+ * never into the last BUILD_RAM_RESERVE bytes of free RAM */
+#define WORK_BUF_INITIAL (64 * 1024)
+#define BUILD_RAM_RESERVE (256 * 1024)
+
+/* Entries of the ':' separated tagcache scan path setting */
+#define MAX_SCAN_ROOTS 12
+
+enum { Q_BUILD = 1 };
+
+static struct event_queue builder_queue SHAREDBSS_ATTR;
+static long builder_stack[(DEFAULT_STACK_SIZE + 0x4000) / sizeof(long)];
+static const char builder_thread_name[] = "custom_db";
+static unsigned int builder_thread_id = 0;
+
+static struct custom_db_build_status status;
+
+static const char *const supported_exts[] = {
+    ".mp3", ".flac", ".ogg", ".wav", ".m4a",
+};
+
+struct build_rec {
+  const char *path;
+  const char *title; /* NULL until known */
+  const char *artist;
+  const char *album;
+  uint32_t size;
+  uint32_t mtime;
+  /* String pool offsets, assigned when writing */
+  uint32_t title_idx, artist_idx, album_idx, path_idx;
+};
+
+/* Work buffer: records grow up from the start, strings down from the end.
+ * It may move whenever the builder yields, except while pinned. */
+static int work_handle = 0;
+static char *work_buf;
+static size_t work_size;
+static struct build_rec *recs;
+static int rec_count;
+static char *str_top;
+
+/* Scratch, only touched by the builder thread */
+static char cur_path[MAX_PATH];
+static struct mp3entry id3;
+static char mf_str[4][MAX_PATH];
+
+/* Buffered reader for the manifest */
+static struct {
+  int fd;
+  int pos, len;
+  unsigned char buf[512];
+} mf_in;
+
+/* Buffered writer for the database and the manifest */
+static struct {
+  int fd;
+  size_t used;
+  bool error;
+  unsigned char buf[1024];
+} wr;
+
+/* String pool dedup, placed in the free middle of the work buffer */
+struct pool_slot {
+  const char *str;
+  uint32_t offset;
+};
+static struct pool_slot *pool_hash;
+static size_t pool_hash_size;
+static uint32_t pool_size;
+
+static bool check_abort(void) {
+  struct queue_event ev;
+
+  if (!queue_peek(&builder_queue, &ev))
+    return false;
+
+  switch (ev.id) {
+  case SYS_POWEROFF:
+  case SYS_REBOOT:
+  case SYS_USB_CONNECTED:
+    return true;
+  }
+  return false;
+}
+
+static bool is_supported(const char *name) {
+  const char *ext = strrchr(name, '.');
+  if (!ext || ext == name)
+    return false;
+
+  for (size_t i = 0; i < ARRAYLEN(supported_exts); i++) {
+    if (!strcasecmp(ext, supported_exts[i]))
+      return true;
+  }
+  return false;
+}
+
+static void relocate_strings(ptrdiff_t diff) {
+  for (int i = 0; i < rec_count; i++) {
+    struct build_rec *r = &recs[i];
+    r->path += diff;
+    if (r->title) {
+      r->title += diff;
+      r->artist += diff;
+      r->album += diff;
+    }
+  }
+}
+
+static int work_move_cb(int handle, void *current, void *new) {
+  (void)handle;
+  ptrdiff_t diff = (char *)new - (char *)current;
+
+  /* buflib copies the data after this returns, fix the records in place */
+  relocate_strings(diff);
+  work_buf += diff;
+  str_top += diff;
+  recs = (struct build_rec *)work_buf;
+  return BUFLIB_CB_OK;
+}
+
+static struct buflib_callbacks work_ops = {
+    .move_callback = work_move_cb,
+    .shrink_callback = NULL,
+};
+
+/* Free bytes between the records and the strings */
+static size_t work_room(void) {
+  char *end = (char *)&recs[rec_count];
+  return str_top > end ? (size_t)(str_top - end) : 0;
+}
+
+/* Makes at least need bytes free between the records and the strings by
+ * moving everything to a bigger allocation. Pointers into the old buffer
+ * are stale afterwards, only indexes into recs stay valid. */
+static bool grow_work_buf(size_t need) {
+  size_t size = work_size + MAX(work_size / 2, need);
+  size_t avail = core_allocatable();
+
+  if (avail <= BUILD_RAM_RESERVE)
+    return false;
+  size = MIN(size, avail - BUILD_RAM_RESERVE);
+  if (size < work_size - work_room() + need)
+    return false;
+
+  int handle = core_alloc_ex(size, &work_ops);
+  if (handle <= 0)
+    return false;
+
+  /* The old buffer may have moved while allocating */
+  char *buf = core_get_data(handle);
+  size_t str_len = work_buf + work_size - str_top;
+  char *new_top = buf + size - str_len;
+
+  memcpy(buf, work_buf, rec_count * sizeof(*recs));
+  memcpy(new_top, str_top, str_len);
+  recs = (struct build_rec *)buf;
+  relocate_strings(new_top - str_top);
+
+  core_free(work_handle);
+  work_handle = handle;
+  work_buf = buf;
+  work_size = size;
+  str_top = new_top;
+  return true;
+}
+
+static const char *work_strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  if (work_room() < len && !grow_work_buf(len))
+    return NULL;
+  str_top -= len;
+  return memcpy(str_top, s, len);
+}
+
+static bool add_rec(const char *path, const struct dirinfo *info) {
+  /* Make room for both at once, growing in between would leave the new
+   * path stale */
+  size_t need = strlen(path) + 1 + sizeof(*recs);
+  if (work_room() < need && !grow_work_buf(need))
+    return false;
+
+  struct build_rec *r = &recs[rec_count];
+  memset(r, 0, sizeof(*r));
+  r->size = info->size;
+  r->mtime = info->mtime;
+  r->path = work_strdup(path);
+  rec_count++;
+
+  status.files_found = rec_count;
+  return true;
+}
+
+/* Walks cur_path recursively. Returns false when out of memory or aborted. */
+static bool scan_dir(void) {
+  DIR *dir = opendir(cur_path);
+  if (!dir) {
+    logf("custom_db: can't open %s", cur_path);
+    return true;
+  }
+
+  bool ok = true;
+  size_t len = strlen(cur_path);
+  if (len > 0 && cur_path[len - 1] == '/')
+    len--;
+
+  struct dirent *entry;
+  while (ok && (entry = readdir(dir))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      continue;
+
+    if (snprintf(cur_path + len, sizeof(cur_path) - len, "/%s",
+                 entry->d_name) >= (int)(sizeof(cur_path) - len))
+      continue;
+
+    struct dirinfo info = dir_get_info(dir, entry);
+    if (info.attribute & ATTR_DIRECTORY)
+      ok = scan_dir();
+    else if (is_supported(entry->d_name))
+      ok = add_rec(cur_path, &info);
+
+    if (ok && check_abort())
+      ok = false;
+  }
+
+  cur_path[len] = '\0';
+  closedir(dir);
+  return ok;
+}
+
+static int path_cmp(const void *a, const void *b) {
+  return strcmp(((const struct build_rec *)a)->path,
+                ((const struct build_rec *)b)->path);
+}
+
+/* Artist -> album -> title, ASCII case folded, path breaks remaining ties.
+ * Same order as the other generators. */
+static int track_cmp(const void *a, const void *b) {
+  const struct build_rec *ra = a, *rb = b;
+  int rc;
+
+  if ((rc = strcasecmp(ra->artist, rb->artist)))
+    return rc;
+  if ((rc = strcasecmp(ra->album, rb->album)))
+    return rc;
+  if ((rc = strcasecmp(ra->title, rb->title)))
+    return rc;
+  return strcmp(ra->path, rb->path);
+}
+
+static int mf_getc(void) {
+  if (mf_in.pos == mf_in.len) {
+    mf_in.len = read(mf_in.fd, mf_in.buf, sizeof(mf_in.buf));
+    mf_in.pos = 0;
+    if (mf_in.len <= 0) {
+      mf_in.len = 0;
+      return -1;
+    }
+  }
+  return mf_in.buf[mf_in.pos++];
+}
+
+static bool mf_read(void *dst, size_t len) {
+  unsigned char *p = dst;
+  while (len-- > 0) {
+    int c = mf_getc();
+    if (c < 0)
+      return false;
+    *p++ = c;
+  }
+  return true;
+}
+
+static bool mf_read32(uint32_t *v) {
+  unsigned char b[4];
+  if (!mf_read(b, 4))
+    return false;
+  *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  return true;
+}
+
+/* Reads a NUL terminated string; *fits turns false if it was truncated */
+static bool mf_gets(char *dst, size_t size, bool *fits) {
+  size_t n = 0;
+  for (;;) {
+    int c = mf_getc();
+    if (c < 0)
+      return false;
+    if (n < size)
+      dst[n++] = c;
+    if (c == '\0')
+      break;
+  }
+  if (dst[n - 1] != '\0') {
+    dst[n - 1] = '\0';
+    *fits = false;
+  }
+  return true;
+}
+
+/* Copies the tags of recs[i] into the work buffer. The record is only
+ * looked up once all three are in, as copying may grow the buffer. */
+static bool set_tags(int i, const char *title, const char *artist,
+                     const char *album) {
+  size_t need = strlen(title) + strlen(artist) + strlen(album) + 3;
+  if (work_room() < need && !grow_work_buf(need))
+    return false;
+
+  struct build_rec *r = &recs[i];
+  r->album = work_strdup(album);
+  r->artist = work_strdup(artist);
+  r->title = work_strdup(title);
+  return true;
+}
+
+/* Takes the tags of unchanged files from the previous manifest. Both lists
+ * are sorted by path, so this is a single merge pass. */
+static bool reuse_manifest(void) {
+  mf_in.fd = open(CUSTOM_DB_MANIFEST_PATH, O_RDONLY);
+  if (mf_in.fd < 0)
+    return true;
+  mf_in.pos = mf_in.len = 0;
+
+  bool ok = true;
+  char magic[4];
+  uint32_t count;
+  if (!mf_read(magic, 4) || memcmp(magic, CUSTOM_DB_MANIFEST_MAGIC, 4) ||
+      !mf_read32(&count))
+    goto out;
+
+  int i = 0;
+  while (count-- > 0 && i < rec_count) {
+    uint32_t size, mtime;
+    bool fits = true;
+
+    if (!mf_read32(&size) || !mf_read32(&mtime))
+      break;
+    for (int k = 0; k < 4; k++) {
+      if (!mf_gets(mf_str[k], MAX_PATH, &fits))
+        goto out;
+    }
+    if (!fits)
+      continue;
+
+    while (i < rec_count && strcmp(recs[i].path, mf_str[0]) < 0)
+      i++;
+    if (i == rec_count || strcmp(recs[i].path, mf_str[0]))
+      continue;
+
+    if (recs[i].size == size && recs[i].mtime == mtime) {
+      if (!set_tags(i, mf_str[1], mf_str[2], mf_str[3])) {
+        ok = false;
+        break;
+      }
+      status.files_done++;
+    }
+  }
+
+out:
+  close(mf_in.fd);
+  return ok;
+}
+
+/* The work buffer may move during the file I/O, so the path is copied out
+ * and recs[i] looked up again afterwards */
+static bool parse_rec(int i) {
+  strmemccpy(cur_path, recs[i].path, sizeof(cur_path));
+  int fd = open(cur_path, O_RDONLY);
+  bool ok = fd >= 0 && get_metadata(&id3, fd, cur_path);
+  if (fd >= 0)
+    close(fd);
+
+  status.files_parsed++;
+  status.files_done++;
+
+  /* Same fallbacks as the PC app */
+  return set_tags(i, ok && id3.title && *id3.title ? id3.title
+                                                    : strrchr(cur_path, '/') + 1,
+                  ok && id3.artist && *id3.artist ? id3.artist
+                                                  : "Unknown Artist",
+                  ok && id3.album && *id3.album ? id3.album : "Unknown Album");
+}
+
+static bool out_open(const char *path) {
+  wr.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  wr.used = 0;
+  wr.error = wr.fd < 0;
+  return !wr.error;
+}
+
+static void out_flush(void) {
+  if (wr.used && !wr.error &&
+      write(wr.fd, wr.buf, wr.used) != (ssize_t)wr.used)
+    wr.error = true;
+  wr.used = 0;
+}
+
+static void out_put(const void *data, size_t len) {
+  const unsigned char *p = data;
+  while (len > 0) {
+    if (wr.used == sizeof(wr.buf))
+      out_flush();
+    size_t n = MIN(len, sizeof(wr.buf) - wr.used);
+    memcpy(wr.buf + wr.used, p, n);
+    wr.used += n;
+    p += n;
+    len -= n;
+  }
+}
+
+static void out_put32(uint32_t v) {
+  unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+  out_put(b, 4);
+}
+
+static bool out_close(void) {
+  out_flush();
+  if (close(wr.fd) < 0)
+    wr.error = true;
+  wr.fd = -1;
+  return !wr.error;
+}
+
+static bool write_manifest(void) {
+  if (!out_open(MANIFEST_TEMP_PATH))
+    return false;
+
+  out_put(CUSTOM_DB_MANIFEST_MAGIC, 4);
+  out_put32(rec_count);
+  for (int i = 0; i < rec_count; i++) {
+    const struct build_rec *r = &recs[i];
+    out_put32(r->size);
+    out_put32(r->mtime);
+    out_put(r->path, strlen(r->path) + 1);
+    out_put(r->title, strlen(r->title) + 1);
+    out_put(r->artist, strlen(r->artist) + 1);
+    out_put(r->album, strlen(r->album) + 1);
+  }
+
+  if (!out_close()) {
+    remove(MANIFEST_TEMP_PATH);
+    return false;
+  }
+  if (rename(MANIFEST_TEMP_PATH, CUSTOM_DB_MANIFEST_PATH) != 0) {
+    remove(MANIFEST_TEMP_PATH);
+    return false;
+  }
+  return true;
+}
+
+static uint32_t str_hash(const char *s) {
+  uint32_t h = 2166136261u; /* FNV-1a */
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static uint32_t pool_add(const char *s) {
+  size_t i = str_hash(s) & (pool_hash_size - 1);
+  while (pool_hash[i].str) {
+    if (!strcmp(pool_hash[i].str, s))
+      return pool_hash[i].offset;
+    i = (i + 1) & (pool_hash_size - 1);
+  }
+
+  pool_hash[i].str = s;
+  pool_hash[i].offset = pool_size;
+  pool_size += strlen(s) + 1;
+  return pool_hash[i].offset;
+}
+
+/* The hash goes between the records and the strings. Every record adds at
+ * most four strings; keep the table at most half full. */
+static bool pool_init(void) {
+  size_t min_size = (size_t)rec_count * 8;
+
+  pool_hash_size = 16;
+  while (pool_hash_size < min_size)
+    pool_hash_size *= 2;
+
+  size_t need = pool_hash_size * sizeof(struct pool_slot) + sizeof(void *);
+  if (work_room() < need && !grow_work_buf(need))
+    return false;
+
+  pool_hash = (struct pool_slot *)ALIGN_UP((uintptr_t)&recs[rec_count],
+                                           sizeof(void *));
+  memset(pool_hash, 0, pool_hash_size * sizeof(struct pool_slot));
+  pool_size = 0;
+  return true;
+}
+
+enum boundary { NEW_ARTIST, NEW_ALBUM, NEW_GROUP, NEW_ENTRY };
+
+static bool is_boundary(int i, enum boundary kind) {
+  if (i == 0 || kind == NEW_ENTRY)
+    return true;
+
+  bool artist = recs[i].artist_idx != recs[i - 1].artist_idx;
+  bool album = recs[i].album_idx != recs[i - 1].album_idx;
+  switch (kind) {
+  case NEW_ARTIST:
+    return artist;
+  case NEW_ALBUM:
+    return album;
+  default:
+    return artist || album;
+  }
+}
+
+static uint32_t count_boundaries(enum boundary kind) {
+  uint32_t n = 0;
+  for (int i = 0; i < rec_count; i++)
+    n += is_boundary(i, kind);
+  return n;
+}
+
+static void put_starts(enum boundary kind) {
+  for (int i = 0; i < rec_count; i++) {
+    if (is_boundary(i, kind))
+      out_put32(i);
+  }
+}
+
+static void put_ranges(enum boundary kind) {
+  int start = 0;
+  for (int i = 1; i <= rec_count; i++) {
+    if (i == rec_count || is_boundary(i, kind)) {
+      out_put32(start);
+      out_put32(i - start);
+      out_put32(recs[start].album_idx);
+      start = i;
+    }
+  }
+}
+
+/* Prefix index rows before sorting */
+struct sort_item {
+  const char *name;
+  uint32_t item;
+  uint32_t name_idx;
+};
+
+static int sort_item_cmp(const void *a, const void *b) {
+  const struct sort_item *ia = a, *ib = b;
+  int rc = strcasecmp(ia->name, ib->name);
+  if (rc)
+    return rc;
+  return ia->item < ib->item ? -1 : ia->item > ib->item;
+}
+
+/* Alphabetical index of the artists, albums (by their first entry) or
+ * titles. The rows are sorted where the pool hash was, which is done with
+ * by now. */
+static void put_prefix_index(enum boundary kind) {
+  struct sort_item *items = (struct sort_item *)pool_hash;
+  uint32_t n = 0;
+
+  for (int i = 0; i < rec_count; i++) {
+    if (!is_boundary(i, kind))
+      continue;
+
+    const struct build_rec *r = &recs[i];
+    struct sort_item *it = &items[n];
+    it->item = n++;
+    if (kind == NEW_ARTIST) {
+      it->name = r->artist;
+      it->name_idx = r->artist_idx;
+    } else if (kind == NEW_ALBUM) {
+      it->name = r->album;
+      it->name_idx = r->album_idx;
+    } else {
+      it->name = r->title;
+      it->name_idx = r->title_idx;
+    }
+  }
+
+  qsort(items, n, sizeof(*items), sort_item_cmp);
+
+  for (uint32_t i = 0; i < n; i++) {
+    char key[DB_PREFIX_LEN] = {0};
+    for (size_t k = 0; k < DB_PREFIX_LEN && items[i].name[k]; k++) {
+      char c = items[i].name[k];
+      key[k] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    out_put(key, DB_PREFIX_LEN);
+    out_put32(items[i].item);
+    out_put32(items[i].name_idx);
+  }
+}
+
+static void put_pool_string(const char *s, uint32_t idx, uint32_t *written) {
+  if (idx == *written) {
+    size_t len = strlen(s) + 1;
+    out_put(s, len);
+    *written += len;
+  }
+}
+
+static bool write_database(void) {
+  /* Offsets are handed out in the order the pool is written below */
+  for (int i = 0; i < rec_count; i++) {
+    struct build_rec *r = &recs[i];
+    r->path_idx = pool_add(r->path);
+    r->title_idx = pool_add(r->title);
+    r->artist_idx = pool_add(r->artist);
+    r->album_idx = pool_add(r->album);
+  }
+
+  struct db_header hdr;
+  memcpy(hdr.magic, DB_MAGIC, 4);
+  hdr.entry_count = rec_count;
+  hdr.artist_count = count_boundaries(NEW_ARTIST);
+  hdr.album_count = count_boundaries(NEW_ALBUM);
+  hdr.group_count = count_boundaries(NEW_GROUP);
+  hdr.artist_index_offset =
+      sizeof(struct db_header) + rec_count * sizeof(struct db_entry);
+  hdr.album_index_offset = hdr.artist_index_offset + hdr.artist_count * 4;
+  hdr.artist_group_offset = hdr.album_index_offset + hdr.album_count * 4;
+  hdr.group_table_offset =
+      hdr.artist_group_offset + (hdr.artist_count + 1) * 4;
+  hdr.album_table_offset =
+      hdr.group_table_offset +
+      hdr.group_count * sizeof(struct db_album_range);
+  hdr.artist_prefix_offset =
+      hdr.album_table_offset +
+      hdr.album_count * sizeof(struct db_album_range);
+  hdr.album_prefix_offset =
+      hdr.artist_prefix_offset + hdr.artist_count * sizeof(struct db_prefix);
+  hdr.title_prefix_offset =
+      hdr.album_prefix_offset + hdr.album_count * sizeof(struct db_prefix);
+  hdr.string_pool_offset =
+      hdr.title_prefix_offset + rec_count * sizeof(struct db_prefix);
+
+  if (!out_open(DB_TEMP_PATH))
+    return false;
+
+  out_put(hdr.magic, 4);
+  out_put32(hdr.entry_count);
+  out_put32(hdr.artist_count);
+  out_put32(hdr.album_count);
+  out_put32(hdr.artist_index_offset);
+  out_put32(hdr.album_index_offset);
+  out_put32(hdr.string_pool_offset);
+  out_put32(hdr.group_count);
+  out_put32(hdr.artist_group_offset);
+  out_put32(hdr.group_table_offset);
+  out_put32(hdr.album_table_offset);
+  out_put32(hdr.artist_prefix_offset);
+  out_put32(hdr.album_prefix_offset);
+  out_put32(hdr.title_prefix_offset);
+
+  for (int i = 0; i < rec_count; i++) {
+    out_put32(recs[i].title_idx);
+    out_put32(recs[i].artist_idx);
+    out_put32(recs[i].album_idx);
+    out_put32(recs[i].path_idx);
+  }
+
+  put_starts(NEW_ARTIST);
+  put_starts(NEW_ALBUM);
+
+  /* First group of every artist, plus the end of the last one */
+  uint32_t groups = 0;
+  for (int i = 0; i < rec_count; i++) {
+    if (is_boundary(i, NEW_ARTIST))
+      out_put32(groups);
+    groups += is_boundary(i, NEW_GROUP);
+  }
+  out_put32(groups);
+
+  put_ranges(NEW_GROUP);
+  put_ranges(NEW_ALBUM);
+
+  put_prefix_index(NEW_ARTIST);
+  put_prefix_index(NEW_ALBUM);
+  put_prefix_index(NEW_ENTRY);
+
+  uint32_t written = 0;
+  for (int i = 0; i < rec_count; i++) {
+    const struct build_rec *r = &recs[i];
+    put_pool_string(r->path, r->path_idx, &written);
+    put_pool_string(r->title, r->title_idx, &written);
+    put_pool_string(r->artist, r->artist_idx, &written);
+    put_pool_string(r->album, r->album_idx, &written);
+  }
+
+  if (!out_close()) {
+    remove(DB_TEMP_PATH);
+    return false;
+  }
+
+  logf("custom_db: %d tracks, %lu artists, %lu albums", rec_count,
+       (unsigned long)hdr.artist_count, (unsigned long)hdr.album_count);
+
+  /* Atomic replace; readers holding the old file keep their copy */
+  if (rename(DB_TEMP_PATH, CUSTOM_DB_PATH) != 0) {
+    remove(DB_TEMP_PATH);
+    return false;
+  }
+  return true;
+}
+
+static bool alloc_work_buf(void) {
+  if (core_allocatable() < WORK_BUF_INITIAL + BUILD_RAM_RESERVE)
+    return false;
+
+  work_handle = core_alloc_ex(WORK_BUF_INITIAL, &work_ops);
+  if (work_handle <= 0) {
+    work_handle = 0;
+    return false;
+  }
+
+  work_buf = core_get_data(work_handle);
+  work_size = WORK_BUF_INITIAL;
+  recs = (struct build_rec *)work_buf;
+  rec_count = 0;
+  str_top = work_buf + work_size;
+  return true;
+}
+
+static void free_work_buf(void) {
+  if (work_handle > 0)
+    work_handle = core_free(work_handle);
+  work_buf = str_top = NULL;
+  work_size = 0;
+  recs = NULL;
+  rec_count = 0;
+}
+
+static enum custom_db_build_result build(void) {
+  char paths[sizeof(global_settings.tagcache_scan_paths)];
+  char *roots[MAX_SCAN_ROOTS];
+  bool ok;
+
+  status.files_found = status.files_done = status.files_parsed = 0;
+
+  if (!alloc_work_buf()) {
+    logf("custom_db: no memory for build");
+    return CUSTOM_DB_BUILD_NO_MEMORY;
+  }
+
+  cpu_boost(true);
+
+  strmemccpy(paths, global_settings.tagcache_scan_paths, sizeof(paths));
+  int n = split_string(paths, ':', roots, MAX_SCAN_ROOTS);
+
+  ok = true;
+  for (int i = 0; ok && i < n; i++) {
+    strmemccpy(cur_path, roots[i], sizeof(cur_path));
+    ok = scan_dir();
+  }
+
+  if (ok) {
+    qsort(recs, rec_count, sizeof(*recs), path_cmp);
+    ok = reuse_manifest();
+  }
+
+  for (int i = 0; ok && i < rec_count; i++) {
+    if (!recs[i].title) {
+      ok = parse_rec(i);
+      yield();
+    }
+    if (ok && check_abort())
+      ok = false;
+  }
+
+  /* Until here only an abort or a full work buffer can have failed */
+  enum custom_db_build_result result = CUSTOM_DB_BUILD_OK;
+  if (!ok)
+    result = check_abort() ? CUSTOM_DB_BUILD_ABORTED
+                           : CUSTOM_DB_BUILD_NO_MEMORY;
+
+  if (ok) {
+    /* The manifest stays in path order for the next merge. Writing yields
+     * while holding pointers into the work buffer, so it is pinned. */
+    core_pin(work_handle);
+    ok = write_manifest();
+    core_unpin(work_handle);
+    if (!ok) {
+      logf("custom_db: manifest write failed");
+      result = CUSTOM_DB_BUILD_WRITE_FAILED;
+    }
+  }
+
+  if (ok) {
+    qsort(recs, rec_count, sizeof(*recs), track_cmp);
+    ok = pool_init();
+    if (!ok) {
+      logf("custom_db: no memory for string pool");
+      result = CUSTOM_DB_BUILD_NO_MEMORY;
+    }
+  }
+
+  if (ok) {
+    core_pin(work_handle);
+    ok = write_database();
+    core_unpin(work_handle);
+    if (!ok) {
+      logf("custom_db: database write failed");
+      result = CUSTOM_DB_BUILD_WRITE_FAILED;
+    }
+  }
+
+  cpu_boost(false);
+
+  if (ok) {
+    logf("custom_db: build done, %d files, %d parsed", status.files_found,
+         status.files_parsed);
+  } else {
+    logf("custom_db: build failed (%d)", result);
+  }
+
+  free_work_buf();
+  return result;
+}
+
+static void builder_thread(void) {
+  struct queue_event ev;
+
+  while (1) {
+    queue_wait(&builder_queue, &ev);
+
+    switch (ev.id) {
+    case Q_BUILD:
+      status.result = build();
+      if (status.result == CUSTOM_DB_BUILD_OK)
+        status.generation++;
+      status.finished++;
+      status.running = false;
+      break;
+
+    case SYS_USB_CONNECTED:
+      usb_acknowledge(SYS_USB_CONNECTED_ACK);
+      usb_wait_for_disconnect(&builder_queue);
+      break;
+    }
+  }
+}
+
+bool custom_db_builder_start(void) {
+  if (status.running)
+    return false;
+
+  if (builder_thread_id == 0) {
+    queue_init(&builder_queue, true);
+    builder_thread_id =
+        create_thread(builder_thread, builder_stack, sizeof(builder_stack), 0,
+                      builder_thread_name IF_PRIO(, PRIORITY_BACKGROUND)
+                          IF_COP(, CPU));
+    if (builder_thread_id == 0)
+      return false;
+  }
+
+  status.running = true;
+  queue_post(&builder_queue, Q_BUILD, 0);
+  return true;
+}
+
+void custom_db_builder_get_status(struct custom_db_build_status *out) {
+  *out = status;
+}
+
+const char *custom_db_builder_error_str(enum custom_db_build_result result) {
+  switch (result) {
+  case CUSTOM_DB_BUILD_ABORTED:
+    return "Database update aborted";
+  case CUSTOM_DB_BUILD_NO_MEMORY:
+    return "Database update failed: not enough memory, stop playback";
+  case CUSTOM_DB_BUILD_WRITE_FAILED:
+    return "Database update failed: can't write database";
+  default:
+    return NULL;
+  }
+}
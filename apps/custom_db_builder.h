@@ -0,0 +1,40 @@
+#ifndef _CUSTOM_DB_BUILDER_H
+#define _CUSTOM_DB_BUILDER_H
+
+#include <stdbool.h>
+
+#include "custom_db.h"
+
+/* Sidecar of the database: size, mtime and tags of every file seen by the
+ * last on-device build, so that unchanged files are not parsed again */
+#define CUSTOM_DB_MANIFEST_PATH CUSTOM_DB_PATH ".manifest"
+#define CUSTOM_DB_MANIFEST_MAGIC "RDM1"
+
+enum custom_db_build_result {
+  CUSTOM_DB_BUILD_NONE = 0,     /* no build has finished yet */
+  CUSTOM_DB_BUILD_OK,           /* new database renamed into place */
+  CUSTOM_DB_BUILD_ABORTED,      /* USB, reboot or power off */
+  CUSTOM_DB_BUILD_NO_MEMORY,    /* buffer held by playback, or too small */
+  CUSTOM_DB_BUILD_WRITE_FAILED, /* manifest or database couldn't be written */
+};
+
+struct custom_db_build_status {
+  bool running;
+  int generation;   /* bumped each time a new database has been installed */
+  int finished;     /* bumped each time a build ends, whatever the result */
+  enum custom_db_build_result result; /* of the last build to end */
+  int files_found;  /* audio files found by the current/last scan */
+  int files_done;   /* of those, how many have tags */
+  int files_parsed; /* of those, how many needed get_metadata() */
+};
+
+/* Rebuild the database in the background from the tagcache scan paths.
+ * Returns false if a build is already running. */
+bool custom_db_builder_start(void);
+
+void custom_db_builder_get_status(struct custom_db_build_status *out);
+
+/* Message for the user about a failed build, NULL for the others */
+const char *custom_db_builder_error_str(enum custom_db_build_result result);
+
+#endif
@@ -48,6 +48,9 @@
 #include "viewport.h"
 #ifdef HAVE_TAGCACHE
 #include "tagcache.h"
+#include "custom_db.h"
+#include "custom_db_browser.h"
+#include "custom_db_builder.h"
 #endif
 #ifdef HAVE_REMOTE_LCD
 #include "lcd-remote.h"
@@ -86,6 +89,7 @@
 #include "pcmbuf.h"
 #include "buffering.h"
 #include "playback.h"
+#include "dsp_core.h"
 #if defined(HAVE_SPDIF_OUT) || defined(HAVE_SPDIF_IN)
 #include "spdif.h"
 #endif
@@ -496,6 +500,31 @@ static bool dbg_buffering_thread(void)
                              pcmbuf_used_descs(), pcmbufdescs);
             screens[i].putsf(0, line++, "watermark: %6d",
                              (int)(d.watermark));
+            screens[i].putsf(0, line++, "chunk: %3dK rate: %5ldK/s",
+                             (int)(d.chunk_size / 1024),
+                             (long)(d.read_rate / 1024));
+            screens[i].putsf(0, line++, "rebuffers: %u", d.rebuffers);
+
+#if LCD_HEIGHT > 80 || (defined(HAVE_REMOTE_LCD) && LCD_REMOTE_HEIGHT > 80)
+            if (screens[i].lcdheight > 80)
+            {
+                for (int h = 0; h < d.num_handle_stats; h++)
+                {
+                    const struct buffering_handle_debug *hd = &d.handles[h];
+                    screens[i].putsf(0, line++,
+                                     "h%d t%d %5ldK/s rb%u w%u",
+                                     hd->id, hd->type,
+                                     (long)(hd->fill_rate / 1024),
+                                     hd->rebuffers, hd->waits);
+                    /* reads taking <1, 1, 2-3, 4-7, 8-15, 16+ ticks */
+                    screens[i].putsf(0, line++,
+                                     " lat: %u %u %u %u %u %u",
+                                     hd->latency[0], hd->latency[1],
+                                     hd->latency[2], hd->latency[3],
+                                     hd->latency[4], hd->latency[5]);
+                }
+            }
+#endif
 
             screens[i].update();
         }
@@ -510,6 +539,75 @@ static bool dbg_buffering_thread(void)
 #undef STR_DATAREM
 }
 
+static long dsp_profile_tick;
+
+static int dsp_profile_callback(int action, struct gui_synclist *lists)
+{
+    (void)lists;
+    struct dsp_config *dsp = dsp_get_config(CODEC_IDX_AUDIO);
+    struct dsp_profile prof;
+
+    if (action == ACTION_STD_OK)
+    {
+        /* Start over */
+        dsp_configure(dsp, DSP_PROFILE_RESET, 0);
+        dsp_profile_tick = current_tick;
+    }
+
+    dsp_configure(dsp, DSP_PROFILE_GET, (intptr_t)&prof);
+
+    long elapsed = current_tick - dsp_profile_tick;
+    uint64_t avail = (uint64_t)prof.clock_hz * MAX(elapsed, 1) / HZ;
+
+    simplelist_reset_lines();
+    simplelist_addline("Time: %ld s (OK: reset)", elapsed / HZ);
+
+    for (int i = 0; i < prof.count; i++)
+    {
+        const struct dsp_profile_stage *st = &prof.stage[i];
+
+        if (!st->calls && !st->active)
+            continue;
+
+        simplelist_addline("%s%s", st->name, st->active ? "" : " (off)");
+
+        if (avail)
+        {
+            /* share of the CPU over the elapsed time, in 0.01 % */
+            int load = st->clocks * 10000 / avail;
+            simplelist_addline(" %lu ms, %d.%02d%% CPU",
+                               (unsigned long)(st->clocks * 1000 /
+                                               prof.clock_hz),
+                               load / 100, load % 100);
+        }
+
+        simplelist_addline(" %lu calls, %lu smp", (unsigned long)st->calls,
+                           (unsigned long)st->samples);
+    }
+
+    if (action == ACTION_NONE)
+        action = ACTION_REDRAW;
+    return action;
+}
+
+static bool dbg_dsp_profile(void)
+{
+    struct dsp_config *dsp = dsp_get_config(CODEC_IDX_AUDIO);
+    struct simplelist_info info;
+
+    dsp_configure(dsp, DSP_PROFILE_ENABLE, true);
+    dsp_profile_tick = current_tick;
+
+    simplelist_info_init(&info, "DSP profile", 0, NULL);
+    info.action_callback = dsp_profile_callback;
+    info.timeout = HZ/2;
+    info.scroll_all = true;
+    bool ret = simplelist_show_list(&info);
+
+    dsp_configure(dsp, DSP_PROFILE_ENABLE, false);
+    return ret;
+}
+
 #ifdef BUFLIB_DEBUG_PRINT
 static const char* bf_getname(int selected_item, void *data,
                                    char *buffer, size_t buffer_len)
@@ -1996,6 +2094,44 @@ static bool dbg_tagcache_info(void)
     tagcache_screensync_enable(true);
     return simplelist_show_list(&info);
 }
+
+static int custom_db_callback(int btn, struct gui_synclist *lists)
+{
+    (void)lists;
+    static const char * const modes[] = { "Closed", "File", "RAM", "mmap" };
+    struct custom_db_build_status build;
+    struct custom_db_enqueue_stat enqueue;
+
+    custom_db_builder_get_status(&build);
+    custom_db_browser_get_enqueue_stat(&enqueue);
+
+    simplelist_reset_lines();
+    simplelist_addline("Mode: %s", modes[custom_db_get_load_mode()]);
+    simplelist_addline("Entries: %d", custom_db_get_entry_count());
+    simplelist_addline("Artists: %d", custom_db_get_artist_count());
+    simplelist_addline("Albums: %d", custom_db_get_album_count());
+    simplelist_addline("Builder: %s (gen %d)",
+                       build.running ? "Running" : "Idle", build.generation);
+    simplelist_addline(" %d/%d files, %d parsed",
+                       build.files_done, build.files_found,
+                       build.files_parsed);
+    simplelist_addline("Last enqueue: %d tracks", enqueue.tracks);
+    simplelist_addline(" in %ld ms", enqueue.ticks * 1000 / HZ);
+
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+    return btn;
+}
+
+static bool dbg_custom_db_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Custom DB Info", 0, NULL);
+    info.action_callback = custom_db_callback;
+    info.timeout = HZ/2;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
 #endif
 
 #if defined CPU_COLDFIRE
@@ -2863,8 +2999,10 @@ static const struct {
 #endif
 #ifdef HAVE_TAGCACHE
         { "View database info", dbg_tagcache_info },
+        { "View custom database info", dbg_custom_db_info },
 #endif
         { "View buffering thread", dbg_buffering_thread },
+        { "View DSP profile", dbg_dsp_profile },
 #ifdef PM_DEBUG
         { "pm histogram", peak_meter_histogram},
 #endif /* PM_DEBUG */
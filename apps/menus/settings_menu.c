@@ -121,6 +121,7 @@ static int selectivesoftlock_set_mask(void *param) {
 
 static void tagcache_rebuild_with_splash(void) {
   tagcache_rebuild();
+  tagtree_cache_invalidate();
   splash(HZ * 2, ID2P(LANG_TAGCACHE_FORCE_UPDATE_SPLASH));
 }
 
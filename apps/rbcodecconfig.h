@@ -82,6 +82,15 @@ static inline void dsp_process_end(struct dsp_loop_context *ctx)
 #define DSP_PROCESS_END() \
     dsp_process_end(&__ctx)
 
+/* Clock for the per-stage DSP profile */
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE) && CONFIG_CPU == X1000
+#define DSP_PROFILE_CLOCK()     __ost_read32()
+#define DSP_PROFILE_CLOCK_HZ    OST_FREQUENCY
+#elif (CONFIG_PLATFORM & PLATFORM_NATIVE) && defined(USEC_TIMER)
+#define DSP_PROFILE_CLOCK()     ((uint32_t)USEC_TIMER)
+#define DSP_PROFILE_CLOCK_HZ    1000000
+#endif
+
 #endif
 
 #define DSP_OUT_MIN_HZ      PLAY_SAMPR_HW_MIN
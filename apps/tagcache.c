@@ -100,6 +100,11 @@
 #ifndef __PCTOOL__
 #include "eeprom_settings.h"
 #include "lang.h"
+#include "tagtree.h"
+#endif
+#ifdef DBTOOL
+#include <pthread.h>
+#include <time.h>
 #endif
 #define USR_CANCEL false
 #else /*!defined(PLUGIN)*/
@@ -434,6 +439,13 @@ static long commit_entry_count;
 static long lookup_buffer_depth;
 static struct tempbuf_searchidx **lookup;
 
+/* Open addressing table of tempbuf entry numbers by tag CRC, carved out of
+ * tempbuf behind the lookup buffer when there is room for it. Lets
+ * tempbuf_insert() find unique tags without scanning every entry; without
+ * it (NULL) the linear scan is used. */
+static long *tempbuf_hash;
+static unsigned long tempbuf_hash_mask;
+
 /* Used when building the temporary file. */
 static int cachefd = -1, filenametag_fd;
 static int total_entry_count = 0;
@@ -714,6 +726,10 @@ static void remove_files(void) {
     snprintf(buf, bufsz, "%s/" TAGCACHE_FILE_INDEX, tc_stat.db_path, i);
     remove(buf);
   }
+#if !defined(__PCTOOL__) && !defined(PLUGIN)
+  /* The next database restarts the commit ids */
+  tagtree_cache_invalidate();
+#endif
 }
 
 static bool check_all_headers(void) {
@@ -1443,8 +1459,78 @@ static bool check_against_clause(long numeric, const char *str,
   return false;
 }
 
+/* States of a tag string in a clause map, two bits each */
+#define CLAUSE_MAP_UNKNOWN 0u
+#define CLAUSE_MAP_FALSE 2u
+#define CLAUSE_MAP_TRUE 3u
+
+/* Size of the tag file (or its RAM copy) of tag, 0 if unknown */
+static long tag_file_size(struct tagcache_search *tcs, int tag) {
+#ifdef HAVE_TC_RAMCACHE
+  if (tcs->ramsearch) {
+    struct tagcache_header *tch =
+        (struct tagcache_header *)tcramcache.hdr->tags[tag];
+    return sizeof(struct tagcache_header) + tch->datasize;
+  }
+#endif
+  if (tcs->idxfd[tag] < 0)
+    return 0;
+  return filesize(tcs->idxfd[tag]);
+}
+
+/* String clauses on unique tags get a map with two bits per entry of the
+ * tag file, keyed by the seek the index entries hold. Each distinct string
+ * is read and compared once; after that the clause is a bit lookup for
+ * every other index entry pointing at it. The first word of a map holds
+ * the number of entries it covers. */
+static void compile_clauses(struct tagcache_search *tcs) {
+  tcs->clauses_compiled = true;
+
+#ifndef __PCTOOL__
+  long words[TAGCACHE_MAX_CLAUSES];
+  long total = 0;
+  int i;
+
+  for (i = 0; i < tcs->clause_count; i++) {
+    const struct tagcache_search_clause *clause = tcs->clause[i];
+
+    words[i] = 0;
+    if (clause->type == clause_logical_or || clause->numeric ||
+        clause->str == NULL || clause->tag >= TAG_COUNT ||
+        !TAGCACHE_IS_UNIQUE(clause->tag))
+      continue;
+
+    long chunks = tag_file_size(tcs, clause->tag) / TAGFILE_ENTRY_CHUNK_LENGTH;
+    if (chunks > 0) {
+      words[i] = 1 + (chunks * 2 + 31) / 32;
+      total += words[i];
+    }
+  }
+
+  if (total == 0)
+    return;
+
+  /* Must not move, the search yields while it is in use */
+  int handle = core_alloc_ex(total * sizeof(uint32_t), &buflib_ops_locked);
+  if (handle <= 0)
+    return;
+
+  tcs->clause_map_handle = handle;
+  uint32_t *map = core_get_data(handle);
+  memset(map, 0, total * sizeof(uint32_t));
+  for (i = 0; i < tcs->clause_count; i++) {
+    if (words[i] == 0)
+      continue;
+    map[0] = (words[i] - 1) * 16;
+    tcs->clause_map[i] = map;
+    map += words[i];
+  }
+#endif
+}
+
 static bool check_clauses(struct tagcache_search *tcs, struct index_entry *idx,
-                          struct tagcache_search_clause **clauses, int count) {
+                          struct tagcache_search_clause **clauses, int count,
+                          bool compiled) {
   int i;
 
   /* Go through all conditional clauses. */
@@ -1454,6 +1540,9 @@ static bool check_clauses(struct tagcache_search *tcs, struct index_entry *idx,
     const int bufsz = sizeof(buf);
     char *str = buf;
     struct tagcache_search_clause *clause = clauses[i];
+    uint32_t *map = compiled ? tcs->clause_map[i] : NULL;
+    uint32_t bit = 0;
+    bool match;
 
     logf_clauses(
         "%s clause %d %s %s [%ld] %s", "Checking", i,
@@ -1467,6 +1556,20 @@ static bool check_clauses(struct tagcache_search *tcs, struct index_entry *idx,
     }
     seek = check_virtual_tags(clause->tag, tcs->idx_id, idx);
 
+    if (map) {
+      uint32_t chunk = (uint32_t)seek / TAGFILE_ENTRY_CHUNK_LENGTH;
+      if (seek >= 0 && chunk < map[0]) {
+        bit = chunk * 2;
+        uint32_t state = (map[1 + bit / 32] >> (bit % 32)) & 3;
+        if (state != CLAUSE_MAP_UNKNOWN) {
+          match = (state == CLAUSE_MAP_TRUE);
+          goto clause_checked;
+        }
+      } else {
+        map = NULL;
+      }
+    }
+
 #ifdef HAVE_TC_RAMCACHE
     if (tcs->ramsearch) {
       struct tagfile_entry *tfe;
@@ -1534,7 +1637,13 @@ static bool check_clauses(struct tagcache_search *tcs, struct index_entry *idx,
       }
     }
 
-    if (!check_against_clause(seek, str, clause)) {
+    match = check_against_clause(seek, str, clause);
+    if (map)
+      map[1 + bit / 32] |= (match ? CLAUSE_MAP_TRUE : CLAUSE_MAP_FALSE)
+                           << (bit % 32);
+
+  clause_checked:
+    if (!match) {
       /* Clause failed -- try finding a logical-or clause */
       while (++i < count) {
         if (clauses[i]->type == clause_logical_or)
@@ -1566,31 +1675,85 @@ bool tagcache_check_clauses(struct tagcache_search *tcs,
   if (!get_index(tcs->masterfd, tcs->idx_id, &idx, true))
     return false;
 
-  return check_clauses(tcs, &idx, clause, count);
+  return check_clauses(tcs, &idx, clause, count, false);
 }
 
-static bool add_uniqbuf(struct tagcache_search *tcs, uint32_t id) {
-  int i;
+/* Marks a free slot of the unique list hash set */
+#define UNIQUE_LIST_EMPTY 0xffffffffu
+
+/* The set is past the load it may take: move its values to the front and
+ * carry on with the linear check */
+static void unique_list_to_linear(struct tagcache_search *tcs) {
+  int count = 0;
+
+  for (int i = 0; i < tcs->unique_list_capacity; i++) {
+    if (tcs->unique_list[i] != UNIQUE_LIST_EMPTY)
+      tcs->unique_list[count++] = tcs->unique_list[i];
+  }
+  if (tcs->unique_list_has_empty)
+    tcs->unique_list[count++] = UNIQUE_LIST_EMPTY;
+
+  tcs->unique_list_count = count;
+  tcs->unique_list_mode = TAGCACHE_UNIQUE_LINEAR;
+}
 
+/* Returns false if id has been seen before in this search */
+static bool add_uniqbuf(struct tagcache_search *tcs, uint32_t id) {
   /* If uniq buffer is not defined we must return true for search to work. */
   if (tcs->unique_list == NULL ||
       (!TAGCACHE_IS_UNIQUE(tcs->type) && !TAGCACHE_IS_NUMERIC(tcs->type))) {
     return true;
   }
 
-  for (i = 0; i < tcs->unique_list_count; i++) {
-    /* Return false if entry is found. */
-    if (tcs->unique_list[i] == id) {
-      // logf("%d Exists @ %d", id, i);
-      return false;
+  if (tcs->unique_list_mode == TAGCACHE_UNIQUE_LINEAR) {
+    for (int i = 0; i < tcs->unique_list_count; i++) {
+      if (tcs->unique_list[i] == id)
+        return false;
     }
+    if (tcs->unique_list_count < tcs->unique_list_capacity)
+      tcs->unique_list[tcs->unique_list_count++] = id;
+    return true;
+  }
+
+  if (tcs->unique_list_mode == TAGCACHE_UNIQUE_BITMAP) {
+    /* Entries of unique tags start on a chunk boundary, so one bit per
+     * chunk of the tag file tells them apart */
+    uint32_t bit = id / TAGFILE_ENTRY_CHUNK_LENGTH;
+    if (bit >= (uint32_t)tcs->unique_list_capacity)
+      return true;
+    if (tcs->unique_list[bit / 32] & BIT_N(bit % 32))
+      return false;
+    tcs->unique_list[bit / 32] |= BIT_N(bit % 32);
+    tcs->unique_list_count++;
+    return true;
   }
 
-  if (tcs->unique_list_count < tcs->unique_list_capacity) {
-    tcs->unique_list[i] = id;
+  if (id == UNIQUE_LIST_EMPTY) {
+    if (tcs->unique_list_has_empty)
+      return false;
+    tcs->unique_list_has_empty = true;
     tcs->unique_list_count++;
+    return true;
+  }
+
+  uint32_t mask = tcs->unique_list_capacity - 1;
+  uint32_t slot = (id * 0x9e3779b1u) & mask;
+  while (tcs->unique_list[slot] != UNIQUE_LIST_EMPTY) {
+    if (tcs->unique_list[slot] == id)
+      return false;
+    slot = (slot + 1) & mask;
+  }
+
+  /* Keep the set at most 3/4 full */
+  if (tcs->unique_list_count >= tcs->unique_list_capacity / 4 * 3) {
+    unique_list_to_linear(tcs);
+    if (tcs->unique_list_count < tcs->unique_list_capacity)
+      tcs->unique_list[tcs->unique_list_count++] = id;
+    return true;
   }
 
+  tcs->unique_list[slot] = id;
+  tcs->unique_list_count++;
   return true;
 }
 
@@ -1600,6 +1763,9 @@ static bool build_lookup_list(struct tagcache_search *tcs) {
 
   tcs->seek_list_count = 0;
 
+  if (!tcs->clauses_compiled)
+    compile_clauses(tcs);
+
 #ifdef HAVE_TC_RAMCACHE
   if (tcs->ramsearch) {
     tcrc_buffer_lock(); /* lock because below makes a pointer to movable data */
@@ -1626,7 +1792,7 @@ static bool build_lookup_list(struct tagcache_search *tcs) {
         continue;
 
       /* Check for conditions. */
-      if (!check_clauses(tcs, idx, tcs->clause, tcs->clause_count))
+      if (!check_clauses(tcs, idx, tcs->clause, tcs->clause_count, true))
         continue;
       /* Add to the seek list if not already in uniq buffer (doesn't yield)*/
       if (!add_uniqbuf(tcs, idx->tag_seek[tcs->type]))
@@ -1689,7 +1855,7 @@ static bool build_lookup_list(struct tagcache_search *tcs) {
       continue;
 
     /* Check for conditions. */
-    if (!check_clauses(tcs, &entry, tcs->clause, tcs->clause_count))
+    if (!check_clauses(tcs, &entry, tcs->clause, tcs->clause_count, true))
       continue;
 
     /* Add to the seek list if not already in uniq buffer. */
@@ -1781,12 +1947,68 @@ bool tagcache_search(struct tagcache_search *tcs, int tag) {
   return true;
 }
 
+/* Sets up the filter that drops results seen before. Unique string tags
+ * get a bitmap over the tag file, numeric tags a hash set of values sized
+ * for every entry being different. Both are linear in the number of
+ * entries. If buffer is too small a buffer of the right size is allocated,
+ * and freed by tagcache_search_finish(); only if that fails as well does
+ * a hash set in buffer have to do. A tag file of unknown size, or a set
+ * that fills up, falls back to checking a list of values in buffer. */
 void tagcache_search_set_uniqbuf(struct tagcache_search *tcs, void *buffer,
                                  long length) {
+  long needed;
+  int capacity;
+  long size = 0;
+  int mode = TAGCACHE_UNIQUE_HASH;
+
+  if (!TAGCACHE_IS_NUMERIC(tcs->type)) {
+    size = tag_file_size(tcs, tcs->type);
+    mode = size > 0 ? TAGCACHE_UNIQUE_BITMAP : TAGCACHE_UNIQUE_LINEAR;
+  }
+
+  if (mode == TAGCACHE_UNIQUE_LINEAR) {
+    capacity = length / sizeof(uint32_t);
+    needed = capacity * sizeof(uint32_t);
+  } else if (mode == TAGCACHE_UNIQUE_BITMAP) {
+    capacity = size / TAGFILE_ENTRY_CHUNK_LENGTH + 1;
+    needed = ALIGN_UP(capacity, 32) / 8;
+  } else {
+    int entries = MAX(tcs->entry_count, current_tcmh.tch.entry_count);
+    capacity = 1;
+    while (capacity < 2 * entries)
+      capacity *= 2;
+    needed = capacity * sizeof(uint32_t);
+  }
+
+#ifndef __PCTOOL__
+  if (tcs->unique_list_handle > 0)
+    tcs->unique_list_handle = core_free(tcs->unique_list_handle);
+  if (needed > length) {
+    /* Must not move, the search yields while it is in use */
+    int handle = core_alloc_ex(needed, &buflib_ops_locked);
+    if (handle > 0) {
+      tcs->unique_list_handle = handle;
+      buffer = core_get_data(handle);
+      length = needed;
+    }
+  }
+#endif
+
+  if (needed > length) {
+    /* Fall back to the largest set that fits */
+    mode = TAGCACHE_UNIQUE_HASH;
+    capacity = 1;
+    while (capacity * 2 * (long)sizeof(uint32_t) <= length)
+      capacity *= 2;
+    needed = capacity * sizeof(uint32_t);
+  }
+
   tcs->unique_list = (uint32_t *)buffer;
-  tcs->unique_list_capacity = length / sizeof(*tcs->unique_list);
+  tcs->unique_list_capacity = capacity;
   tcs->unique_list_count = 0;
-  memset(tcs->unique_list, 0, tcs->unique_list_capacity);
+  tcs->unique_list_mode = mode;
+  tcs->unique_list_has_empty = false;
+  memset(tcs->unique_list, mode == TAGCACHE_UNIQUE_HASH ? 0xff : 0, needed);
 }
 
 bool tagcache_search_add_filter(struct tagcache_search *tcs, int tag,
@@ -2029,6 +2251,16 @@ void tagcache_search_finish(struct tagcache_search *tcs) {
     }
   }
 
+#ifndef __PCTOOL__
+  if (tcs->unique_list_handle > 0)
+    tcs->unique_list_handle = core_free(tcs->unique_list_handle);
+  if (tcs->clause_map_handle > 0)
+    tcs->clause_map_handle = core_free(tcs->clause_map_handle);
+#endif
+  tcs->unique_list = NULL;
+  memset(tcs->clause_map, 0, sizeof(tcs->clause_map));
+  tcs->clauses_compiled = false;
+
   tcs->ramsearch = false;
   tcs->valid = false;
   tcs->initialized = 0;
@@ -2166,43 +2398,26 @@ static void db_log(const char *prefix, const char *msg) {
 }
 #endif
 
-/* GCC 3.4.6 for Coldfire can choose to inline this function. Not a good
- * idea, as it uses lots of stack and is called from a recursive function
- * (check_dir).
- */
-static void NO_INLINE add_tagcache(char *path, unsigned long mtime) {
-#define ADD_TAG(entry, tag, data)                                              \
-  /* Adding tag */                                                             \
-  entry.tag_length[tag] = check_if_empty(data);                                \
-  entry.tag_offset[tag] = offset;                                              \
-  offset += entry.tag_length[tag]
-
-  struct mp3entry id3;
-  struct temp_file_entry entry;
-  bool ret;
+/* Returns true if path is a supported file that is not in the database yet
+ * or has been modified since; a stale entry is deleted. */
+static bool need_tagcache_entry(char *path, unsigned long mtime) {
   int idx_id = -1;
-  char tracknumfix[3];
-  int offset = 0;
   int path_length = strlen(path);
-  bool has_artist;
-  bool has_grouping;
-
-  DB_LOG("file", path);
 
   if (cachefd < 0)
-    return;
+    return false;
 
   /* Check for overlength file path. */
   if (path_length > MAX_PATH || path_length > TAG_MAXLEN) {
     /* Path can't be shortened. */
     logf("Too long path: %s", path);
     DB_LOG("error", "path too long");
-    return;
+    return false;
   }
 
   /* Check if the file is supported. */
   if (probe_file_format(path) == AFMT_UNKNOWN)
-    return;
+    return false;
 
   /* Check if the file is already cached. */
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
@@ -2223,12 +2438,12 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime) {
     if (!get_index(-1, idx_id, &idx, true)) {
       logf("failed to retrieve index entry");
       DB_LOG("error", "failed to retrieve index entry");
-      return;
+      return false;
     }
 
     if ((unsigned long)idx.tag_seek[tag_mtime] == mtime) {
       /* No changes to file. */
-      return;
+      return false;
     }
 
     /* Metadata might have been changed. Delete the entry. */
@@ -2237,58 +2452,65 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime) {
     if (!delete_entry(idx_id)) {
       logf("delete_entry failed: %d", idx_id);
       DB_LOG("error", "delete entry failed");
-      return;
+      return false;
     }
   }
 
-  /*memset(&id3, 0, sizeof(struct mp3entry)); -- get_metadata does this for us
-   */
-  memset(&entry, 0, sizeof(struct temp_file_entry));
-  memset(&tracknumfix, 0, sizeof(tracknumfix));
-  ret = get_metadata_ex(&id3, -1, path, METADATA_EXCLUDE_ID3_PATH);
+  return true;
+}
 
-  if (!ret) {
-    logf("get_metadata failed: %s", path);
-    DB_LOG("error", "get_metadata failed");
-    return;
-  }
+/* Appends the parsed metadata of path to the temporary db file. */
+static void add_tagcache_entry(char *path, unsigned long mtime,
+                               struct mp3entry *id3) {
+#define ADD_TAG(entry, tag, data)                                              \
+  /* Adding tag */                                                             \
+  entry.tag_length[tag] = check_if_empty(data);                                \
+  entry.tag_offset[tag] = offset;                                              \
+  offset += entry.tag_length[tag]
+
+  struct temp_file_entry entry;
+  int offset = 0;
+  bool has_artist;
+  bool has_grouping;
+
+  memset(&entry, 0, sizeof(struct temp_file_entry));
 
   logf("-> %s", path);
 
-  if (id3.tracknum < 0) /* Track number missing? */
+  if (id3->tracknum < 0) /* Track number missing? */
   {
-    id3.tracknum = -1;
+    id3->tracknum = -1;
   }
 
   /* Numeric tags */
-  entry.tag_offset[tag_year] = id3.year;
-  entry.tag_offset[tag_discnumber] = id3.discnum;
-  entry.tag_offset[tag_tracknumber] = id3.tracknum;
-  entry.tag_offset[tag_length] = id3.length;
-  entry.tag_offset[tag_bitrate] = id3.bitrate;
+  entry.tag_offset[tag_year] = id3->year;
+  entry.tag_offset[tag_discnumber] = id3->discnum;
+  entry.tag_offset[tag_tracknumber] = id3->tracknum;
+  entry.tag_offset[tag_length] = id3->length;
+  entry.tag_offset[tag_bitrate] = id3->bitrate;
   entry.tag_offset[tag_mtime] = mtime;
 
   /* String tags. */
-  has_artist = id3.artist != NULL && strlen(id3.artist) > 0;
-  has_grouping = id3.grouping != NULL && strlen(id3.grouping) > 0;
+  has_artist = id3->artist != NULL && strlen(id3->artist) > 0;
+  has_grouping = id3->grouping != NULL && strlen(id3->grouping) > 0;
 
   ADD_TAG(entry, tag_filename, &path);
-  ADD_TAG(entry, tag_title, &id3.title);
-  ADD_TAG(entry, tag_artist, &id3.artist);
-  ADD_TAG(entry, tag_album, &id3.album);
-  ADD_TAG(entry, tag_genre, &id3.genre_string);
-  ADD_TAG(entry, tag_composer, &id3.composer);
-  ADD_TAG(entry, tag_comment, &id3.comment);
-  ADD_TAG(entry, tag_albumartist, &id3.albumartist);
+  ADD_TAG(entry, tag_title, &id3->title);
+  ADD_TAG(entry, tag_artist, &id3->artist);
+  ADD_TAG(entry, tag_album, &id3->album);
+  ADD_TAG(entry, tag_genre, &id3->genre_string);
+  ADD_TAG(entry, tag_composer, &id3->composer);
+  ADD_TAG(entry, tag_comment, &id3->comment);
+  ADD_TAG(entry, tag_albumartist, &id3->albumartist);
   if (has_artist) {
-    ADD_TAG(entry, tag_virt_canonicalartist, &id3.artist);
+    ADD_TAG(entry, tag_virt_canonicalartist, &id3->artist);
   } else {
-    ADD_TAG(entry, tag_virt_canonicalartist, &id3.albumartist);
+    ADD_TAG(entry, tag_virt_canonicalartist, &id3->albumartist);
   }
   if (has_grouping) {
-    ADD_TAG(entry, tag_grouping, &id3.grouping);
+    ADD_TAG(entry, tag_grouping, &id3->grouping);
   } else {
-    ADD_TAG(entry, tag_grouping, &id3.title);
+    ADD_TAG(entry, tag_grouping, &id3->title);
   }
   entry.data_length = offset;
 
@@ -2297,28 +2519,212 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime) {
 
   /* And tags also... Correct order is critical */
   write_item(path);
-  write_item(id3.title);
-  write_item(id3.artist);
-  write_item(id3.album);
-  write_item(id3.genre_string);
-  write_item(id3.composer);
-  write_item(id3.comment);
-  write_item(id3.albumartist);
+  write_item(id3->title);
+  write_item(id3->artist);
+  write_item(id3->album);
+  write_item(id3->genre_string);
+  write_item(id3->composer);
+  write_item(id3->comment);
+  write_item(id3->albumartist);
   if (has_artist) {
-    write_item(id3.artist);
+    write_item(id3->artist);
   } else {
-    write_item(id3.albumartist);
+    write_item(id3->albumartist);
   }
   if (has_grouping) {
-    write_item(id3.grouping);
+    write_item(id3->grouping);
   } else {
-    write_item(id3.title);
+    write_item(id3->title);
   }
 
   total_entry_count++;
 
 #undef ADD_TAG
 }
+
+#ifndef DBTOOL
+/* GCC 3.4.6 for Coldfire can choose to inline this function. Not a good
+ * idea, as it uses lots of stack and is called from a recursive function
+ * (check_dir).
+ */
+static void NO_INLINE add_tagcache(char *path, unsigned long mtime) {
+  struct mp3entry id3;
+
+  DB_LOG("file", path);
+
+  if (!need_tagcache_entry(path, mtime))
+    return;
+
+  /*memset(&id3, 0, sizeof(struct mp3entry)); -- get_metadata does this for us
+   */
+  if (!get_metadata_ex(&id3, -1, path, METADATA_EXCLUDE_ID3_PATH)) {
+    logf("get_metadata failed: %s", path);
+    DB_LOG("error", "get_metadata failed");
+    return;
+  }
+
+  add_tagcache_entry(path, mtime, &id3);
+}
+#else  /* DBTOOL */
+/* The host database tool queues the files found by check_dir(), parses them
+ * on a pool of threads a batch at a time and appends each batch to the temp
+ * file in scan order, so the result doesn't depend on the thread count. */
+#define PARSE_BATCH 1024
+
+struct parse_job {
+  char *path;
+  unsigned long mtime;
+};
+
+struct parse_result {
+  bool ok;
+  struct mp3entry id3;
+};
+
+static struct parse_job *parse_jobs;
+static long parse_job_count, parse_job_alloc;
+static struct parse_result *parse_results;
+static long parse_batch_start, parse_batch_count, parse_next;
+static int parse_threads = 1;
+static struct tagcache_build_stats build_stats;
+
+/* The sim file layer allocates descriptors from a shared table; opening and
+ * closing must not race. Reads on distinct descriptors are fine. */
+static pthread_mutex_t parse_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double build_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void tagcache_set_build_threads(int threads) {
+  if (threads > MAX_OPEN_FILES - 4)
+    threads = MAX_OPEN_FILES - 4;
+  parse_threads = MAX(threads, 1);
+}
+
+void tagcache_get_build_stats(struct tagcache_build_stats *stats) {
+  *stats = build_stats;
+}
+
+static void queue_tagcache(char *path, unsigned long mtime) {
+  DB_LOG("file", path);
+  build_stats.files++;
+
+  if (!need_tagcache_entry(path, mtime))
+    return;
+
+  if (parse_job_count == parse_job_alloc) {
+    long alloc = parse_job_alloc ? parse_job_alloc * 2 : PARSE_BATCH;
+    struct parse_job *jobs = realloc(parse_jobs, alloc * sizeof(*jobs));
+    if (!jobs) {
+      logf("out of memory queuing %s", path);
+      return;
+    }
+    parse_jobs = jobs;
+    parse_job_alloc = alloc;
+  }
+
+  char *copy = strdup(path);
+  if (!copy) {
+    logf("out of memory queuing %s", path);
+    return;
+  }
+
+  parse_jobs[parse_job_count].path = copy;
+  parse_jobs[parse_job_count++].mtime = mtime;
+}
+
+static void *parse_worker(void *arg) {
+  (void)arg;
+  for (;;) {
+    long i = __atomic_fetch_add(&parse_next, 1, __ATOMIC_RELAXED);
+    if (i >= parse_batch_count)
+      break;
+
+    const char *path = parse_jobs[parse_batch_start + i].path;
+    struct parse_result *res = &parse_results[i];
+
+    pthread_mutex_lock(&parse_fd_lock);
+    int fd = open(path, O_RDONLY);
+    pthread_mutex_unlock(&parse_fd_lock);
+
+    res->ok = fd >= 0 &&
+              get_metadata_ex(&res->id3, fd, path, METADATA_EXCLUDE_ID3_PATH);
+
+    if (fd >= 0) {
+      pthread_mutex_lock(&parse_fd_lock);
+      close(fd);
+      pthread_mutex_unlock(&parse_fd_lock);
+    }
+  }
+  return NULL;
+}
+
+/* Parses the queued files and adds them to the temporary db file */
+static void add_queued_tagcache(void) {
+  pthread_t tid[MAX_OPEN_FILES];
+  long i;
+
+  long count = parse_job_count;
+
+  parse_results = malloc(PARSE_BATCH * sizeof(*parse_results));
+  if (!parse_results) {
+    logf("out of memory for %d results", PARSE_BATCH);
+    count = 0;
+  }
+
+  for (parse_batch_start = 0; parse_batch_start < count;
+       parse_batch_start += parse_batch_count) {
+    double t0 = build_clock();
+
+    parse_batch_count = MIN(count - parse_batch_start, PARSE_BATCH);
+    parse_next = 0;
+    if (parse_threads > 1) {
+      int threads = MIN(parse_threads, parse_batch_count);
+      int started = 0;
+      /* The workers share the queue, so any that started get through all
+       * of it */
+      for (int t = 0; t < threads; t++) {
+        if (pthread_create(&tid[started], NULL, parse_worker, NULL) == 0)
+          started++;
+        else
+          logf("can't start parse thread %d", t);
+      }
+      if (started == 0)
+        parse_worker(NULL);
+      for (int t = 0; t < started; t++)
+        pthread_join(tid[t], NULL);
+    } else {
+      parse_worker(NULL);
+    }
+
+    double t1 = build_clock();
+    build_stats.parse += t1 - t0;
+
+    for (i = 0; i < parse_batch_count; i++) {
+      struct parse_job *job = &parse_jobs[parse_batch_start + i];
+      if (parse_results[i].ok) {
+        add_tagcache_entry(job->path, job->mtime, &parse_results[i].id3);
+      } else {
+        logf("get_metadata failed: %s", job->path);
+        DB_LOG("error", "get_metadata failed");
+      }
+    }
+
+    build_stats.append += build_clock() - t1;
+  }
+
+  for (i = 0; i < parse_job_count; i++)
+    free(parse_jobs[i].path);
+  free(parse_jobs);
+  free(parse_results);
+  parse_jobs = NULL;
+  parse_results = NULL;
+  parse_job_count = parse_job_alloc = 0;
+}
+#endif /* DBTOOL */
 #endif /*!defined(PLUGIN)*/
 
 static bool tempbuf_insert(char *str, int id, int idx_id, bool unique) {
@@ -2335,19 +2741,24 @@ static bool tempbuf_insert(char *str, int id, int idx_id, bool unique) {
   }
 
   if (unique) {
-    /* Check if the crc does not exist -> entry does not exist for sure. */
-    for (i = 0; i < tempbufidx; i++) {
-      if (crcbuf[-i] != crc32)
-        continue;
-
-      if (!strcasecmp(str, index[i].str)) {
-        if (id < 0 || id >= lookup_buffer_depth) {
-          logf("lookup buf overf.: %d", id);
-          return false;
-        }
+    if (tempbuf_hash) {
+      /* Equal tags share a probe sequence, in insertion order, so this
+       * finds the same (first) entry as the scan below */
+      unsigned long slot;
+      for (slot = crc32 & tempbuf_hash_mask; tempbuf_hash[slot] >= 0;
+           slot = (slot + 1) & tempbuf_hash_mask) {
+        i = tempbuf_hash[slot];
+        if (crcbuf[-i] == crc32 && !strcasecmp(str, index[i].str))
+          goto found;
+      }
+    } else {
+      /* Check if the crc does not exist -> entry does not exist for sure. */
+      for (i = 0; i < tempbufidx; i++) {
+        if (crcbuf[-i] != crc32)
+          continue;
 
-        lookup[id] = &index[i];
-        return true;
+        if (!strcasecmp(str, index[i].str))
+          goto found;
       }
     }
   }
@@ -2380,9 +2791,26 @@ static bool tempbuf_insert(char *str, int id, int idx_id, bool unique) {
   index[tempbufidx].str = &tempbuf[tempbuf_pos];
   memcpy(index[tempbufidx].str, str, len);
   tempbuf_pos += len;
+
+  if (tempbuf_hash) {
+    unsigned long slot = crc32 & tempbuf_hash_mask;
+    while (tempbuf_hash[slot] >= 0)
+      slot = (slot + 1) & tempbuf_hash_mask;
+    tempbuf_hash[slot] = tempbufidx;
+  }
+
   tempbufidx++;
 
   return true;
+
+found:
+  if (id < 0 || id >= lookup_buffer_depth) {
+    logf("lookup buf overf.: %d", id);
+    return false;
+  }
+
+  lookup[id] = &index[i];
+  return true;
 }
 
 static int compare(const void *p1, const void *p2) {
@@ -2804,6 +3232,24 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd) {
   tempbuf_pos += lookup_buffer_depth * sizeof(void **);
   memset(lookup, 0, lookup_buffer_depth * sizeof(void **));
 
+  /* Hash table for tempbuf_insert(), at most half full, only if it leaves
+   * twice the room the check below asks for */
+  {
+    unsigned long hash_size = 1;
+    while (hash_size < 2 * (unsigned long)commit_entry_count)
+      hash_size <<= 1;
+    long hash_bytes = hash_size * sizeof(*tempbuf_hash);
+
+    tempbuf_hash = NULL;
+    if ((long)tempbuf_size - tempbuf_pos - 8 - hash_bytes -
+            2 * TAGFILE_ENTRY_AVG_LENGTH * commit_entry_count >= 0) {
+      tempbuf_hash = (long *)&tempbuf[tempbuf_pos];
+      tempbuf_hash_mask = hash_size - 1;
+      tempbuf_pos += hash_bytes;
+      memset(tempbuf_hash, 0xff, hash_bytes);
+    }
+  }
+
   /* And calculate the remaining data space used mainly for storing
    * tag data (strings). */
   tempbuf_left = tempbuf_size - tempbuf_pos - 8;
@@ -3366,6 +3812,9 @@ static bool commit(void) {
     tc_debug_log("Writing master header");
     write_master_header(masterfd, &tcmh);
     close(masterfd);
+#if !defined(__PCTOOL__) && !defined(PLUGIN)
+    tagtree_cache_invalidate();
+#endif
 
     logf("tagcache committed");
     tc_debug_log("tagcache committed");
@@ -3560,6 +4009,13 @@ long tagcache_increase_serial(void) {
   return old;
 }
 
+long tagcache_get_commitid(void) { return current_tcmh.commitid; }
+
+void tagcache_get_master_size(long *entry_count, long *datasize) {
+  *entry_count = current_tcmh.tch.entry_count;
+  *datasize = current_tcmh.tch.datasize;
+}
+
 void tagcache_update_numeric(int idx_id, int tag, long data) {
   queue_command(CMD_UPDATE_NUMERIC, idx_id, tag, data);
 }
@@ -4766,7 +5222,11 @@ static bool check_dir(const char *dirname, int add_files, int depth) {
       tc_stat.curentry = curpath;
 
       /* Add a new entry to the temporary db file. */
+#ifdef DBTOOL
+      queue_tagcache(curpath, info.mtime);
+#else
       add_tagcache(curpath, info.mtime);
+#endif
 
       /* Wait until current path for debug screen is read and unset. */
       /* while (tc_stat.syncscreen && tc_stat.curentry != NULL)
@@ -4803,6 +5263,10 @@ static
   data_size = 0;
   total_entry_count = 0;
   processed_dir_count = 0;
+#ifdef DBTOOL
+  memset(&build_stats, 0, sizeof(build_stats));
+  double build_start = build_clock();
+#endif
 
 #ifdef HAVE_DIRCACHE
   dircache_wait();
@@ -4910,6 +5374,14 @@ static
   }
   free_search_roots(&roots_ll[0]);
 
+#ifdef DBTOOL
+  build_stats.scan = build_clock() - build_start;
+  build_stats.parsed = parse_job_count;
+  build_stats.threads = parse_threads;
+  add_queued_tagcache();
+  build_stats.added = total_entry_count;
+#endif
+
   /* Write the header. */
   header.magic = TAGCACHE_MAGIC;
   header.datasize = data_size;
@@ -4932,6 +5404,9 @@ static
   /* Commit changes to the database. */
 #ifdef __PCTOOL__
   allocate_tempbuf();
+#endif
+#ifdef DBTOOL
+  double commit_start = build_clock();
 #endif
   if (commit()) {
     logf("tagcache built!");
@@ -4939,6 +5414,9 @@ static
   } else {
     tc_debug_log("commit returned false");
   }
+#ifdef DBTOOL
+  build_stats.commit = build_clock() - commit_start;
+#endif
 #ifdef __PCTOOL__
   free_tempbuf();
 #endif
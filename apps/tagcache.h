@@ -127,6 +127,13 @@ struct tagcache_seeklist_entry {
     int32_t idx_id;
 };
 
+/* How tagcache_search.unique_list tells results seen before */
+enum tagcache_unique_mode {
+    TAGCACHE_UNIQUE_LINEAR = 0, /* list of values, searched in full */
+    TAGCACHE_UNIQUE_BITMAP,     /* one bit per chunk of the tag file */
+    TAGCACHE_UNIQUE_HASH,       /* open addressing set of values */
+};
+
 struct tagcache_search {
     /* For internal use only. */
     int fd, masterfd;
@@ -144,9 +151,15 @@ struct tagcache_search {
     int entry_count;
     bool valid;
     bool initialized;
-    uint32_t *unique_list;
-    int unique_list_capacity;
+    uint32_t *unique_list;     /* see enum tagcache_unique_mode */
+    int unique_list_capacity;  /* bits of the bitmap / slots of the set */
     int unique_list_count;
+    int unique_list_handle;    /* allocated by tagcache_search_set_uniqbuf() */
+    unsigned char unique_list_mode;
+    bool unique_list_has_empty; /* set contains its empty marker value */
+    uint32_t *clause_map[TAGCACHE_MAX_CLAUSES]; /* see compile_clauses() */
+    int clause_map_handle;
+    bool clauses_compiled;
 
     /* Exported variables. */
     bool ramsearch;      /* Is ram copy of the tagcache being used. */
@@ -167,6 +180,23 @@ void tagcache_reverse_scan(void);
 void do_tagcache_build(const char *path[]);
 #endif
 
+#ifdef DBTOOL
+struct tagcache_build_stats {
+    long files;     /* files found by the scan */
+    long parsed;    /* of those, new or modified ones handed to the parser */
+    long added;     /* entries written to the temporary db file */
+    int threads;    /* parser threads used */
+    double scan;    /* seconds spent walking the tree and checking the db */
+    double parse;   /* seconds parsing metadata on the thread pool */
+    double append;  /* seconds writing the temporary db file */
+    double commit;  /* seconds building the database files */
+};
+
+/* Parse metadata on this many host threads during do_tagcache_build() */
+void tagcache_set_build_threads(int threads);
+void tagcache_get_build_stats(struct tagcache_build_stats *stats);
+#endif
+
 const char* tagcache_tag_to_str(int tag);
 
 bool tagcache_find_index(struct tagcache_search *tcs, const char *filename);
@@ -185,6 +215,8 @@ bool tagcache_retrieve(struct tagcache_search *tcs, int idxid,
 void tagcache_search_finish(struct tagcache_search *tcs);
 long tagcache_get_numeric(const struct tagcache_search *tcs, int tag);
 long tagcache_increase_serial(void);
+long tagcache_get_commitid(void);
+void tagcache_get_master_size(long *entry_count, long *datasize);
 bool tagcache_import_changelog(void);
 bool tagcache_create_changelog(struct tagcache_search *tcs);
 void tagcache_update_numeric(int idx_id, int tag, long data);
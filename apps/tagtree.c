@@ -123,7 +123,8 @@ enum variables {
     menu_shuffle_songs,
 };
 
-/* Capacity 10 000 entries (for example 10k different artists) */
+/* Unique filter for searches: a bitmap covering tag files of up to 4 MiB.
+ * tagcache allocates a bigger buffer itself when this is not enough. */
 #define UNIQBUF_SIZE (64*1024)
 static uint32_t uniqbuf[UNIQBUF_SIZE / sizeof(uint32_t)];
 
@@ -1100,6 +1101,7 @@ int tagtree_import(void)
     {
         splash(HZ*2, ID2P(LANG_FAILED));
     }
+    tagtree_cache_invalidate();
 
     return 0;
 }
@@ -1584,6 +1586,353 @@ static void tcs_get_basename(struct tagcache_search *tcs, bool is_basename)
     }
 }
 
+/* Persistent result cache: views with many entries are saved after they
+ * have been searched and sorted once, and read back the next time they are
+ * opened. Files are keyed by a crc of everything the view depends on and
+ * are only used for the database that they were made from; tagcache drops
+ * them all on a commit or when it removes the database. Views that filter,
+ * sort or show runtime statistics are never cached: those values are
+ * written through the tagcache command queue some time after they change,
+ * so nothing on disk tells when such a view went stale. */
+#define TAGTREE_CACHE_DIR         ROCKBOX_DIR "/tagtree_cache"
+#define TAGTREE_CACHE_MAGIC       0x54544303 /* "TTC" + version */
+#define TAGTREE_CACHE_MIN_ENTRIES 200
+#define TAGTREE_CACHE_MAX_FILES   32
+
+/* numeric tags that change without a commit */
+#define TAGTREE_STATS_TAGS ((1LU << tag_playcount) | (1LU << tag_rating) | \
+    (1LU << tag_playtime) | (1LU << tag_lastplayed) | \
+    (1LU << tag_lastelapsed) | (1LU << tag_lastoffset) | \
+    (1LU << tag_virt_playtime_min) | (1LU << tag_virt_playtime_sec) | \
+    (1LU << tag_virt_autoscore))
+
+/* The database a view was read from. Commit ids restart when the database
+ * is rebuilt, so the size of the master index is checked as well. */
+struct tagtree_cache_db {
+    int32_t commitid;
+    int32_t entry_count;
+    int32_t datasize;
+};
+
+struct tagtree_cache_header {
+    int32_t magic;
+    uint32_t key;
+    struct tagtree_cache_db db;
+    int32_t count;       /* entries, not counting the special ones */
+    int32_t total_count;
+    int32_t names_size;  /* name and album name of each entry */
+};
+
+struct tagtree_cache_entry {
+    int32_t newtable;
+    int32_t extraseek;
+};
+
+static bool is_stats_tag(int tag)
+{
+    return tag >= 0 && tag < TAG_COUNT_ALL &&
+           (BIT_N(tag) & TAGTREE_STATS_TAGS);
+}
+
+static uint32_t cache_clause_crc(const struct tagcache_search_clause *clause,
+                                 uint32_t crc, bool *stats)
+{
+    int32_t data[5] = { clause->tag, clause->type, clause->numeric,
+                        clause->source, clause->numeric_data };
+
+    *stats |= is_stats_tag(clause->tag);
+    crc = crc_32(data, sizeof(data), crc);
+    if (clause->str)
+        crc = crc_32(clause->str, strlen(clause->str) + 1, crc);
+    return crc;
+}
+
+/* crc of the search, the display formats and the settings that end up in
+ * the entries of the current view */
+static uint32_t tagtree_cache_key(struct tree_context *c, int level,
+                                  int tag, bool is_basename, bool *stats)
+{
+    int32_t data[4] = { c->currtable, level, tag, is_basename };
+    int group_id;
+    uint32_t crc;
+    int i, j;
+
+    *stats = is_stats_tag(tag);
+    crc = crc_32(data, sizeof(data), 0xffffffff);
+
+    for (i = 0; i <= level; i++)
+    {
+        int32_t order[3] = { csi->tagorder[i],
+                             i < level ? csi->result_seek[i] : 0,
+                             csi->clause_count[i] };
+
+        *stats |= is_stats_tag(csi->tagorder[i]);
+        crc = crc_32(order, sizeof(order), crc);
+        for (j = 0; j < csi->clause_count[i]; j++)
+            crc = cache_clause_crc(csi->clause[i][j], crc, stats);
+    }
+
+    if (c->currtable == TABLE_ALLSUBENTRIES_SORTED_BY_ALBUMS)
+        group_id = csi->format_id[level + 1];
+    else
+        group_id = csi->format_id[level];
+
+    for (i = 0; i < format_count; i++)
+    {
+        struct display_format *fmt = formats[i];
+        int32_t fmtdata[5] = { fmt->tag_count, fmt->limit, fmt->strip,
+                               fmt->sort_inverse, fmt->clause_count };
+
+        if (fmt->group_id != group_id)
+            continue;
+
+        crc = crc_32(fmtdata, sizeof(fmtdata), crc);
+        if (fmt->formatstr)
+            crc = crc_32(fmt->formatstr, strlen(fmt->formatstr) + 1, crc);
+        for (j = 0; j < fmt->tag_count; j++)
+        {
+            int32_t fmttag = fmt->tags[j];
+            *stats |= is_stats_tag(fmttag);
+            crc = crc_32(&fmttag, sizeof(fmttag), crc);
+        }
+        for (j = 0; j < fmt->clause_count; j++)
+            crc = cache_clause_crc(fmt->clause[j], crc, stats);
+    }
+
+    data[0] = global_settings.interpret_numbers;
+    crc = crc_32(data, sizeof(data[0]), crc);
+    crc = crc_32(str(LANG_TAGNAVI_UNTAGGED),
+                 strlen(str(LANG_TAGNAVI_UNTAGGED)), crc);
+
+    return crc;
+}
+
+static void tagtree_cache_db(struct tagtree_cache_db *db)
+{
+    long entry_count, datasize;
+
+    tagcache_get_master_size(&entry_count, &datasize);
+    db->commitid = tagcache_get_commitid();
+    db->entry_count = entry_count;
+    db->datasize = datasize;
+}
+
+static void tagtree_cache_path(char *buf, size_t bufsize, uint32_t key)
+{
+    snprintf(buf, bufsize, TAGTREE_CACHE_DIR "/%08lx.tcc",
+             (unsigned long)key);
+}
+
+/* Appends the cached entries of a view after the special entries. A file
+ * that doesn't match is removed. Must be called with the tree cache locked. */
+static bool tagtree_cache_load(struct tree_context *c, uint32_t key,
+                               const struct tagtree_cache_db *db,
+                               int *total_count, void *buf, size_t bufsize)
+{
+    struct tagtree_cache_header hdr;
+    struct tagtree_cache_entry *ce = buf;
+    const int chunk = bufsize / sizeof(*ce);
+    char path[MAX_PATH];
+    struct tagentry *dptr;
+    char *names, *p;
+    int fd, i, n;
+
+    tagtree_cache_path(path, sizeof(path), key);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+        || hdr.magic != TAGTREE_CACHE_MAGIC || hdr.key != key
+        || memcmp(&hdr.db, db, sizeof(*db))
+        || hdr.count < 0
+        || hdr.count > c->cache.max_entries - current_entry_count
+        || hdr.names_size <= 0
+        || hdr.names_size > c->cache.name_buffer_size)
+        goto fail;
+
+    names = core_get_data(c->cache.name_buffer_handle);
+    if (read(fd, names, hdr.names_size) != hdr.names_size
+        || names[hdr.names_size - 1] != '\0')
+        goto fail;
+
+    p = names;
+    dptr = get_entries(c) + current_entry_count;
+    for (i = 0; i < hdr.count; i += n)
+    {
+        int j;
+
+        n = MIN(hdr.count - i, chunk);
+        if (read(fd, ce, n * sizeof(*ce)) != (ssize_t)(n * sizeof(*ce)))
+            goto fail;
+
+        for (j = 0; j < n; j++, dptr++)
+        {
+            if (p >= names + hdr.names_size)
+                goto fail;
+            dptr->newtable = ce[j].newtable;
+            dptr->extraseek = ce[j].extraseek;
+            dptr->customaction = ONPLAY_NO_CUSTOMACTION;
+            dptr->name = p;
+            p += strlen(p) + 1;
+
+            if (p >= names + hdr.names_size)
+                goto fail;
+            dptr->album_name = *p ? p : NULL;
+            p += strlen(p) + 1;
+        }
+    }
+
+    close(fd);
+    current_entry_count += hdr.count;
+    *total_count = hdr.total_count;
+    logf("%s: %d entries from %s", __func__, hdr.count, path);
+    return true;
+
+fail:
+    close(fd);
+    remove(path);
+    return false;
+}
+
+static bool cache_write_buffered(int fd, char *buf, size_t bufsize,
+                                 size_t *used, const void *data, size_t len)
+{
+    if (*used + len > bufsize)
+    {
+        if (write(fd, buf, *used) != (ssize_t)*used)
+            return false;
+        *used = 0;
+    }
+
+    if (len > bufsize)
+        return write(fd, data, len) == (ssize_t)len;
+
+    memcpy(buf + *used, data, len);
+    *used += len;
+    return true;
+}
+
+/* Makes room for a new file by removing the one written longest ago once
+ * there are TAGTREE_CACHE_MAX_FILES, or all of them if there are more */
+static void tagtree_cache_prune(void)
+{
+    char path[MAX_PATH];
+    time_t oldest_mtime = 0;
+    struct dirent *entry;
+    int count = 0;
+    DIR *dir = opendir(TAGTREE_CACHE_DIR);
+
+    if (!dir)
+        return;
+
+    while ((entry = readdir(dir)))
+    {
+        struct dirinfo info = dir_get_info(dir, entry);
+
+        if (entry->d_name[0] == '.' || (info.attribute & ATTR_DIRECTORY))
+            continue;
+        if (count++ == 0 || info.mtime < oldest_mtime)
+        {
+            oldest_mtime = info.mtime;
+            snprintf(path, sizeof(path), TAGTREE_CACHE_DIR "/%s",
+                     entry->d_name);
+        }
+    }
+
+    closedir(dir);
+
+    if (count > TAGTREE_CACHE_MAX_FILES)
+        tagtree_cache_invalidate();
+    else if (count == TAGTREE_CACHE_MAX_FILES)
+        remove(path);
+}
+
+/* Saves the (sorted and stripped) entries of the current view, which were
+ * read from db. Must be called with the tree cache locked. */
+static void tagtree_cache_save(struct tree_context *c, uint32_t key,
+                               const struct tagtree_cache_db *db,
+                               int total_count, void *buf, size_t bufsize)
+{
+    struct tagtree_cache_header hdr;
+    struct tagentry *entries = get_entries(c) + c->special_entry_count;
+    char path[MAX_PATH];
+    size_t used = 0;
+    int fd, i;
+    bool ok = true;
+
+    hdr.magic = TAGTREE_CACHE_MAGIC;
+    hdr.key = key;
+    hdr.db = *db;
+    hdr.count = current_entry_count - c->special_entry_count;
+    hdr.total_count = total_count;
+    hdr.names_size = 0;
+    for (i = 0; i < hdr.count; i++)
+    {
+        hdr.names_size += strlen(entries[i].name) + 1;
+        if (entries[i].album_name)
+            hdr.names_size += strlen(entries[i].album_name);
+        hdr.names_size++;
+    }
+
+    tagtree_cache_path(path, sizeof(path), key);
+    if (!file_exists(path))
+        tagtree_cache_prune();
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        mkdir(TAGTREE_CACHE_DIR);
+        fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (fd < 0)
+            return;
+    }
+
+    ok = cache_write_buffered(fd, buf, bufsize, &used, &hdr, sizeof(hdr));
+    for (i = 0; ok && i < hdr.count; i++)
+    {
+        const char *album = entries[i].album_name ? entries[i].album_name : "";
+
+        ok = cache_write_buffered(fd, buf, bufsize, &used, entries[i].name,
+                                  strlen(entries[i].name) + 1)
+          && cache_write_buffered(fd, buf, bufsize, &used, album,
+                                  strlen(album) + 1);
+    }
+    for (i = 0; ok && i < hdr.count; i++)
+    {
+        struct tagtree_cache_entry ce = { entries[i].newtable,
+                                          entries[i].extraseek };
+
+        ok = cache_write_buffered(fd, buf, bufsize, &used, &ce, sizeof(ce));
+    }
+    if (ok && used > 0)
+        ok = write(fd, buf, used) == (ssize_t)used;
+
+    close(fd);
+    if (!ok)
+        remove(path);
+}
+
+/* Drops all cached views */
+void tagtree_cache_invalidate(void)
+{
+    char path[MAX_PATH];
+    struct dirent *entry;
+    DIR *dir = opendir(TAGTREE_CACHE_DIR);
+
+    if (!dir)
+        return;
+
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), TAGTREE_CACHE_DIR "/%s", entry->d_name);
+        remove(path);
+    }
+
+    closedir(dir);
+}
+
 static int retrieve_entries(struct tree_context *c, int offset, bool init)
 {
     logf( "%s", __func__);
@@ -1602,6 +1951,9 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
     bool is_basename = false;
     int sort_limit;
     int strip;
+    uint32_t cache_key = 0;
+    struct tagtree_cache_db cache_db;
+    bool cache_stats = false;
 
     /* Show search progress straight away if the disk needs to spin up,
        otherwise show it after the normal 1/2 second delay */
@@ -1766,6 +2118,25 @@ static int retrieve_entries(struct tree_context *c, int offset, bool init)
             total_count++;
     }
 
+    if (init && offset == 0)
+    {
+        cache_key = tagtree_cache_key(c, level, tag, is_basename,
+                                      &cache_stats);
+        /* Before searching, so that a view that races with a commit is
+         * saved for the old database */
+        tagtree_cache_db(&cache_db);
+        if (cache_stats)
+            cache_key = 0;
+        else if (tagtree_cache_load(c, cache_key, &cache_db, &total_count,
+                                    tcs_buf, tcs_bufsz))
+        {
+            tagcache_search_finish(&tcs);
+            tree_unlock_cache(c);
+            core_unpin(tagtree_handle);
+            return total_count;
+        }
+    }
+
     while (tagcache_get_next(&tcs, tcs_buf, tcs_bufsz))
     {
         if (total_count++ < offset)
@@ -1989,6 +2360,15 @@ entry_skip_formatter:
         }
     }
 
+    if (cache_key && !c->dirfull && !(strip && c->special_entry_count) &&
+        current_entry_count - c->special_entry_count >= TAGTREE_CACHE_MIN_ENTRIES)
+    {
+        tree_lock_cache(c);
+        tagtree_cache_save(c, cache_key, &cache_db, total_count,
+                           tcs_buf, tcs_bufsz);
+        tree_unlock_cache(c);
+    }
+
     return total_count;
 
 }
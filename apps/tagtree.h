@@ -33,6 +33,7 @@
 
 int tagtree_export(void);
 int tagtree_import(void);
+void tagtree_cache_invalidate(void);
 void tagtree_init(void) INIT_ATTR;
 int tagtree_enter(struct tree_context* c, bool is_visible);
 void tagtree_exit(struct tree_context* c, bool is_visible);
@@ -136,7 +136,12 @@ struct codec_api {
     /* Request pointer to file buffer which can be used to read
        <realsize> amount of data. <reqsize> tells the buffer system
        how much data it should try to allocate. If <realsize> is 0,
-       end of file is reached. */
+       end of file is reached.
+       The data is not copied: the pointer stays valid until the next
+       advance_buffer, request_buffer or seek_buffer call. Data wrapping
+       around the end of the ring buffer is made contiguous through a guard
+       buffer, so <reqsize> should not exceed 32 KiB. Prefer this over
+       read_filebuf for compressed audio. */
     void* (*request_buffer)(size_t *realsize, size_t reqsize);
     /* Advance file buffer position by <amount> amount of bytes. */
     void (*advance_buffer)(size_t amount);
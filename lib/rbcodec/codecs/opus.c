@@ -45,36 +45,77 @@ extern char *global_stack;
 #define MAX_FRAME_SIZE  (2*120*48)
 #define CHUNKSIZE       (16*1024)
 #define SEEK_CHUNKSIZE 7*CHUNKSIZE
+/* Largest request_buffer() span, bounded by the guard buffer */
+#define SPANSIZE        (32*1024)
 
-static int get_more_data(ogg_sync_state *oy)
+static int get_more_data(ogg_sync_state *oy, long size)
 {
     int bytes;
     char *buffer;
 
-    buffer = (char *)ogg_sync_buffer(oy, CHUNKSIZE);
-    bytes = ci->read_filebuf(buffer, CHUNKSIZE);
+    buffer = (char *)ogg_sync_buffer(oy, size);
+    bytes = ci->read_filebuf(buffer, size);
     ogg_sync_wrote(oy,bytes);
 
     return bytes;
 }
 
+/* If nothing is left in the sync buffer and the next page is in the file
+   buffer in one piece, point og at it there instead of copying it in.
+   Returns the page length to advance by once the page has been added to
+   the stream, or 0 if it has to go through the sync buffer. */
+static long get_span_page(ogg_sync_state *oy, ogg_page *og)
+{
+    ogg_sync_state span;
+    size_t size;
+    void *buf;
+
+    if (oy->fill > oy->returned)
+        return 0;
+
+    buf = ci->request_buffer(&size, SPANSIZE);
+    if (!buf)
+        return 0;
+
+    /* checking the crc writes the same bytes back, which is harmless */
+    ogg_sync_init(&span);
+    span.data = buf;
+    span.storage = span.fill = size;
+
+    long len = ogg_sync_pageseek(&span, og);
+    return len > 0 ? len : 0;
+}
+
+/* Find <code> from the current file position on and stop in front of it */
+static int seek_to_code(const char *code, size_t len)
+{
+    while (1) {
+        size_t size;
+        const char *buf = ci->request_buffer(&size, SPANSIZE);
+        if (!buf || size < len)
+            return 0;
+
+        const char *p = buf, *end = buf + size - len + 1;
+        while ((p = memchr(p, code[0], end - p)) != NULL) {
+            if (memcmp(p, code, len) == 0) {
+                ci->advance_buffer(p - buf);
+                return 1;
+            }
+            p++;
+        }
+
+        ci->advance_buffer(end - buf);
+    }
+}
+
 /* seek to ogg page after given file position */
 static int seek_ogg_page(uint64_t filepos)
 {
     const char synccode[] = "OggS\0"; /* Note: there are two nulls here */
-    char buf[sizeof(synccode)];
     ci->seek_buffer(filepos);
-    while (ci->read_filebuf(buf, 1) == 1) {
-        if (buf[0] == synccode[0]) {
-            if (ci->read_filebuf(&buf[1], sizeof(buf) - 1) != sizeof(buf) - 1)
-                break;
-            if (memcmp(buf, synccode, sizeof(buf)) == 0) {
-                ci->seek_buffer(ci->curpos - sizeof(buf));
-                LOGF("next page %jd", (intmax_t) ci->curpos);
-                return 1;
-            } else
-                ci->seek_buffer(ci->curpos - (sizeof(buf) - 1));
-        }
+    if (seek_to_code(synccode, sizeof(synccode))) {
+        LOGF("next page %jd", (intmax_t) ci->curpos);
+        return 1;
     }
     return 0;
 }
@@ -83,19 +124,10 @@ static int seek_ogg_page(uint64_t filepos)
 static int seek_opus_tags(void)
 {
     const char synccode[] = "OpusTags";
-    char buf[sizeof(synccode) - 1]; /* Exclude null */
     ci->seek_buffer(0);
-    while (ci->read_filebuf(buf, 1) == 1) {
-        if (buf[0] == synccode[0]) {
-            if (ci->read_filebuf(&buf[1], sizeof(buf) - 1) != sizeof(buf) - 1)
-                break;
-            if (memcmp(buf, synccode, sizeof(buf)) == 0) {
-                ci->seek_buffer(ci->curpos - sizeof(buf));
-                LOGF("OpusTags %jd", (intmax_t) ci->curpos);
-                return 1;
-            } else
-                ci->seek_buffer(ci->curpos - (sizeof(buf) - 1));
-        }
+    if (seek_to_code(synccode, sizeof(synccode) - 1)) { /* Exclude null */
+        LOGF("OpusTags %jd", (intmax_t) ci->curpos);
+        return 1;
     }
     /* comment header not found probably invalid file */
     return 0;
@@ -123,7 +155,7 @@ static int64_t get_next_page(ogg_sync_state *oy, ogg_page *og,
                 /* send more data */
                 if(!boundary)return(-1);
                 {
-                    ret = get_more_data(oy);
+                    ret = get_more_data(oy, CHUNKSIZE);
                     if (ret == 0)
                         return(-2);
 
@@ -374,6 +406,7 @@ enum codec_status codec_run(void)
     int skip = 0;
     int64_t seek_target;
     uint64_t granule_pos;
+    long span_len;
 
     ogg_malloc_init();
 
@@ -431,13 +464,27 @@ enum codec_status codec_run(void)
             break;
 
     next_page:
-        /*Get the ogg buffer for writing*/
-        if (get_more_data(oy) < 1) {
-            goto done;
+        /* Most pages can be read straight from the file buffer */
+        span_len = get_span_page(oy, &og);
+        if (span_len == 0) {
+            /* Otherwise only read up to the end of the page when its size
+               is known, so that the next one can come from there again */
+            long size = CHUNKSIZE;
+            if (oy->headerbytes)
+                size = oy->headerbytes + oy->bodybytes -
+                       (oy->fill - oy->returned);
+
+            /*Get the ogg buffer for writing*/
+            if (get_more_data(oy, size) < 1) {
+                goto done;
+            }
+
+            if (ogg_sync_pageout(oy, &og) != 1)
+                continue;
         }
 
         /* Loop for all complete pages we got (most likely only one) */
-        while (ogg_sync_pageout(oy, &og) == 1) {
+        do {
             if (stream_init != 0) {
                 stream_init = ogg_stream_init(os, ogg_page_serialno(&og));
                 if (stream_init != 0) {
@@ -452,6 +499,12 @@ enum codec_status codec_run(void)
             page_granule = ogg_page_granulepos(&og);
             granule_pos = page_granule;
 
+            /* The page has been copied into the stream, done with the span */
+            if (span_len > 0) {
+                ci->advance_buffer(span_len);
+                span_len = 0;
+            }
+
             while ((ogg_stream_packetout(os, &op) == 1) && !op.e_o_s) {
                 if (op.packetno == 0){
                     /* identification header */
@@ -524,7 +577,7 @@ enum codec_status codec_run(void)
                     }
                 }
             }
-        }
+        } while (ogg_sync_pageout(oy, &og) == 1);
     }
     LOGF("Returned OK");
     error = CODEC_OK;
@@ -26,6 +26,7 @@
 #include "dsp_proc_entry.h"
 #include "channel_mode.h"
 #include <string.h>
+#include <stddef.h>
 
 #if 0
 /* SOUND_CHAN_STEREO mode is a noop so has no function - just outline one for
@@ -56,6 +57,13 @@ static struct channel_mode_data
     .mode = SOUND_CHAN_STEREO
 };
 
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct channel_mode_data, sw_gain) == 0x00 &&
+               offsetof(struct channel_mode_data, sw_cross) == 0x04,
+               "dsp_mips.S: channel_mode_data");
+#endif /* DSP_MIPS_ASM */
+
 #if 0
 /* SOUND_CHAN_STEREO mode is a noop so has no function - just outline one for
  * completeness. */
@@ -67,7 +75,7 @@ void channel_mode_proc_stereo(struct dsp_proc_entry *this,
 }
 #endif
 
-#if !defined(CPU_COLDFIRE) && !defined(CPU_ARM)
+#if !defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)
 /* Unoptimized routines */
 void channel_mode_proc_mono(struct dsp_proc_entry *this,
                             struct dsp_buffer **buf_p)
@@ -29,6 +29,7 @@
 #include "dsp_filter.h"
 #include "crossfeed.h"
 #include <string.h>
+#include <stddef.h>
 
 /* Implemented here or in target assembly code */
 void crossfeed_process(struct dsp_proc_entry *this,
@@ -74,6 +75,23 @@ static struct crossfeed_state
     };
 } crossfeed_state IBSS_ATTR;
 
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct crossfeed_state, vcl) == 0x04 &&
+               offsetof(struct crossfeed_state, vcr) == 0x08 &&
+               offsetof(struct crossfeed_state, vdiff) == 0x0c &&
+               offsetof(struct crossfeed_state, coef1) == 0x10 &&
+               offsetof(struct crossfeed_state, coef2) == 0x14,
+               "dsp_mips.S: crossfeed_state (meier)");
+_Static_assert(offsetof(struct crossfeed_state, gain) == 0x00 &&
+               offsetof(struct crossfeed_state, coefs) == 0x04 &&
+               offsetof(struct crossfeed_state, history) == 0x10 &&
+               offsetof(struct crossfeed_state, index) == 0x20 &&
+               offsetof(struct crossfeed_state, index_max) == 0x24 &&
+               offsetof(struct crossfeed_state, delay) == 0x28,
+               "dsp_mips.S: crossfeed_state (custom)");
+#endif /* DSP_MIPS_ASM */
+
 static int crossfeed_type = CROSSFEED_TYPE_NONE;
 /* Cached custom settings */
 static long crossfeed_lf_gain;
@@ -172,7 +190,8 @@ void dsp_set_crossfeed_cross_params(long lf_gain, long hf_gain, long cutoff)
                                    dsp_get_output_frequency(dsp));
 }
 
-#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM)) || defined(CPU_ARM_MICRO)
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)) || \
+    defined(CPU_ARM_MICRO)
 /* Apply the crossfade to the buffer in place */
 void crossfeed_process(struct dsp_proc_entry *this, struct dsp_buffer **buf_p)
 {
@@ -224,7 +243,8 @@ void crossfeed_process(struct dsp_proc_entry *this, struct dsp_buffer **buf_p)
 }
 #endif /* CPU */
 
-#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM)) || defined(CPU_ARM_MICRO)
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)) || \
+    defined(CPU_ARM_MICRO)
 /**
  * Implementation of the "simple" passive crossfeed circuit by Jan Meier.
  * See also: http://www.meier-audio.homepage.t-online.de/passivefilter.htm
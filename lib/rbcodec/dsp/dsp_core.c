@@ -26,6 +26,8 @@
 
 #include "tdspeed.h"
 #include "resample.h"
+#include <string.h>
+#include <stddef.h>
 
 /* Define LOGF_ENABLE to enable logf output in this file */
 /*#define LOGF_ENABLE*/
@@ -42,6 +44,12 @@
 #define DSP_PROCESS_END()
 #endif /* !DSP_PROCESS_START */
 
+#ifndef DSP_PROFILE_CLOCK
+/* No clock available - profiling only counts calls and samples */
+#define DSP_PROFILE_CLOCK()     0
+#define DSP_PROFILE_CLOCK_HZ    0
+#endif /* !DSP_PROFILE_CLOCK */
+
 /* Linked lists give fewer loads in processing loop compared to some index
  * list, which is more important than keeping occasionally executed code
  * simple */
@@ -62,8 +70,31 @@ struct dsp_config
         uint8_t db_index;           /* Index in database array */
     } *proc_slots;                  /* Pointer to first in list of enabled
                                        stages */
+    bool profile;                   /* Keep per-stage profile counters */
 };
 
+#if defined(DSP_MIPS_ASM) && !defined(CPU_MIPS)
+#error DSP_MIPS_ASM is only for MIPS targets
+#endif
+
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct dsp_buffer, remcount) == 0x00,
+               "dsp_mips.S: dsp_buffer.remcount");
+_Static_assert(offsetof(struct dsp_buffer, p32[0]) == 0x04 &&
+               offsetof(struct dsp_buffer, p32[1]) == 0x08 &&
+               offsetof(struct dsp_buffer, p16out) == 0x04,
+               "dsp_mips.S: dsp_buffer.p32/p16out");
+_Static_assert(offsetof(struct dsp_buffer, bufcount) == 0x0c,
+               "dsp_mips.S: dsp_buffer.bufcount");
+_Static_assert(offsetof(struct dsp_buffer, format.num_channels) == 0x11,
+               "dsp_mips.S: dsp_buffer.format.num_channels");
+_Static_assert(offsetof(struct dsp_buffer, format.output_scale) == 0x13,
+               "dsp_mips.S: dsp_buffer.format.output_scale");
+_Static_assert(offsetof(struct dsp_proc_entry, data) == 0x00,
+               "dsp_mips.S: dsp_proc_entry.data");
+#endif /* DSP_MIPS_ASM */
+
 #define NACT_BIT    BIT_N(___DSP_PROC_ID_RESERVED)
 
 /* Pool of slots for stages - supports 32 or fewer combined as-is atm. */
@@ -73,6 +104,31 @@ dsp_proc_slot_arr[DSP_NUM_PROC_STAGES+DSP_VOICE_NUM_PROC_STAGES] IBSS_ATTR;
 /* General DSP config */
 static struct dsp_config dsp_conf[DSP_COUNT] IBSS_ATTR;
 
+/* Profile counters: input conversion, one per database entry (same index),
+ * output conversion */
+struct dsp_profile_counter
+{
+    uint32_t calls;
+    uint64_t samples;
+    uint64_t clocks;
+};
+
+#define DSP_PROFILE_INPUT   0
+#define DSP_PROFILE_STAGE   1
+#define DSP_PROFILE_OUTPUT  (DSP_NUM_PROC_STAGES+1)
+#define DSP_PROFILE_COUNT   (DSP_NUM_PROC_STAGES+2)
+
+static struct dsp_profile_counter
+dsp_profile_counters[DSP_COUNT][DSP_PROFILE_COUNT];
+
+/* Stage names for the profile, in database order */
+#define DSP_PROC_DB_START \
+    static const char * const dsp_proc_names[] = {
+#define DSP_PROC_DB_ITEM(name) \
+    #name,
+#define DSP_PROC_DB_STOP };
+#include "dsp_proc_database.h"
+
 static const dsp_proc_init_fn_type dsp_init_fn[] INITDATA_ATTR = {
     &dsp_timestretch_init,
     &dsp_resample_init,
@@ -365,7 +421,8 @@ static NO_INLINE bool dsp_proc_new_format(struct dsp_proc_slot *s,
     }
 }
 
-static FORCE_INLINE void dsp_proc_call(struct dsp_proc_slot *s,
+/* Returns true if the stage's process() was called */
+static FORCE_INLINE bool dsp_proc_call(struct dsp_proc_slot *s,
                                        struct dsp_config *dsp,
                                        struct dsp_buffer **buf_p)
 {
@@ -374,18 +431,116 @@ static FORCE_INLINE void dsp_proc_call(struct dsp_proc_slot *s,
     if (UNLIKELY(buf->format.version != s->version))
     {
         if (!dsp_proc_new_format(s, dsp, buf))
-            return;
+            return false;
     }
 
     if (s->mask)
     {
         if ((s->mask & (buf->proc_mask | NACT_BIT)) || buf->remcount <= 0)
-            return;
+            return false;
 
         buf->proc_mask |= s->mask;
     }
 
     s->proc_entry.process(&s->proc_entry, buf_p);
+    return true;
+}
+
+/** Profiling **/
+static inline void dsp_profile_add(struct dsp_profile_counter *c,
+                                   int samples, uint32_t start)
+{
+    c->calls++;
+    c->samples += samples;
+    c->clocks += (uint32_t)(DSP_PROFILE_CLOCK() - start);
+}
+
+/* Same as the input conversion and stage loop of dsp_process() but with
+ * each step timed */
+static NO_INLINE void dsp_process_profiled(struct dsp_config *dsp,
+                                           struct dsp_buffer **buf_p)
+{
+    struct dsp_profile_counter *c = dsp_profile_counters[dsp_get_id(dsp)];
+    uint32_t start = DSP_PROFILE_CLOCK();
+
+    dsp->io_data.input_samples(&dsp->io_data, buf_p);
+    dsp_profile_add(&c[DSP_PROFILE_INPUT], (*buf_p)->remcount, start);
+
+    for (struct dsp_proc_slot *s = dsp->proc_slots; s; s = s->next)
+    {
+        int count = (*buf_p)->remcount;
+
+        start = DSP_PROFILE_CLOCK();
+
+        if (dsp_proc_call(s, dsp, buf_p))
+            dsp_profile_add(&c[DSP_PROFILE_STAGE + s->db_index], count, start);
+    }
+}
+
+static NO_INLINE void dsp_output_profiled(struct dsp_config *dsp,
+                                          struct dsp_buffer *buf,
+                                          struct dsp_buffer *dst)
+{
+    struct dsp_profile_counter *c = dsp_profile_counters[dsp_get_id(dsp)];
+    uint32_t start = DSP_PROFILE_CLOCK();
+
+    dsp->io_data.output_samples(&dsp->io_data, buf, dst);
+    dsp_profile_add(&c[DSP_PROFILE_OUTPUT], dsp->io_data.outcount, start);
+}
+
+static intptr_t dsp_profile_configure(struct dsp_config *dsp,
+                                      unsigned int setting, intptr_t value)
+{
+    struct dsp_profile_counter *c = dsp_profile_counters[dsp_get_id(dsp)];
+
+    switch (setting)
+    {
+    case DSP_PROFILE_ENABLE:
+        if (value && !dsp->profile)
+            memset(c, 0, sizeof (dsp_profile_counters[0]));
+
+        dsp->profile = value != 0;
+        break;
+
+    case DSP_PROFILE_RESET:
+        memset(c, 0, sizeof (dsp_profile_counters[0]));
+        break;
+
+    case DSP_PROFILE_GET:
+    {
+        struct dsp_profile *profile = (struct dsp_profile *)value;
+        int count = MIN(DSP_PROFILE_COUNT, DSP_PROFILE_MAX_STAGES);
+
+        profile->clock_hz = DSP_PROFILE_CLOCK_HZ;
+        profile->count = count;
+
+        for (int i = 0; i < count; i++)
+        {
+            struct dsp_profile_stage *stage = &profile->stage[i];
+
+            if (i == DSP_PROFILE_INPUT || i == DSP_PROFILE_OUTPUT)
+            {
+                stage->name = i == DSP_PROFILE_INPUT ? "input" : "output";
+                stage->active = true;
+            }
+            else
+            {
+                unsigned int db_index = i - DSP_PROFILE_STAGE;
+                stage->name = dsp_proc_names[db_index];
+                stage->active = dsp_proc_active(dsp,
+                                    dsp_proc_database[db_index]->id);
+            }
+
+            stage->calls = c[i].calls;
+            stage->samples = c[i].samples;
+            stage->clocks = c[i].clocks;
+        }
+
+        return count;
+    }
+    }
+
+    return 0;
 }
 
 /**
@@ -455,13 +610,20 @@ void dsp_process(struct dsp_config *dsp, struct dsp_buffer *src,
          * and switch the buffer to their own output buffer */
         struct dsp_buffer *buf = src;
 
-        /* Convert input samples to internal format */
-        dsp->io_data.input_samples(&dsp->io_data, &buf);
+        if (UNLIKELY(dsp->profile))
+        {
+            dsp_process_profiled(dsp, &buf);
+        }
+        else
+        {
+            /* Convert input samples to internal format */
+            dsp->io_data.input_samples(&dsp->io_data, &buf);
 
-        /* Call all active/enabled stages depending if format is
-           same/changed on the last output buffer */
-        for (struct dsp_proc_slot *s = dsp->proc_slots; s; s = s->next)
-            dsp_proc_call(s, dsp, &buf);
+            /* Call all active/enabled stages depending if format is
+               same/changed on the last output buffer */
+            for (struct dsp_proc_slot *s = dsp->proc_slots; s; s = s->next)
+                dsp_proc_call(s, dsp, &buf);
+        }
 
         /* Don't overread/write src/destination */
         int outcount = MIN(dst->bufcount, buf->remcount);
@@ -473,7 +635,11 @@ void dsp_process(struct dsp_config *dsp, struct dsp_buffer *src,
             dsp_sample_output_format_change(&dsp->io_data, &buf->format);
 
         dsp->io_data.outcount = outcount;
-        dsp->io_data.output_samples(&dsp->io_data, buf, dst);
+
+        if (UNLIKELY(dsp->profile))
+            dsp_output_profiled(dsp, buf, dst);
+        else
+            dsp->io_data.output_samples(&dsp->io_data, buf, dst);
 
         /* Advance buffers by what output consumed and produced */
         dsp_advance_buffer32(buf, outcount);
@@ -488,6 +654,9 @@ void dsp_process(struct dsp_config *dsp, struct dsp_buffer *src,
 intptr_t dsp_configure(struct dsp_config *dsp, unsigned int setting,
                        intptr_t value)
 {
+    if (setting >= DSP_PROFILE_ENABLE)
+        return dsp_profile_configure(dsp, setting, value);
+
     return proc_broadcast(dsp, setting, value);
 }
 
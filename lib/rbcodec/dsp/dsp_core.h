@@ -46,6 +46,17 @@ enum dsp_settings
     DSP_PROC_SETTING, /* stage-specific should be this + id */
 };
 
+/* Profiling settings - handled by dsp_configure() itself and placed above
+   the range of stage-specific settings */
+enum dsp_profile_settings
+{
+    DSP_PROFILE_ENABLE = DSP_PROC_SETTING + 32, /* value: bool; turning it
+                                                   on clears the counters */
+    DSP_PROFILE_RESET,                          /* clear the counters */
+    DSP_PROFILE_GET,                            /* value: struct dsp_profile *,
+                                                   returns stage count */
+};
+
 enum dsp_stereo_modes
 {
     STEREO_INTERLEAVED,
@@ -138,6 +149,27 @@ unsigned int dsp_get_id(const struct dsp_config *dsp);
 void dsp_process(struct dsp_config *dsp, struct dsp_buffer *src,
                  struct dsp_buffer *dst, bool thread_yield);
 
+/* Counters of one processing step since the last profile reset */
+struct dsp_profile_stage
+{
+    const char *name;   /* stage name, "input"/"output" for the conversions */
+    bool active;        /* stage is currently enabled and active */
+    uint32_t calls;     /* number of process() calls */
+    uint64_t samples;   /* samples handed to process() */
+    uint64_t clocks;    /* time spent in process(), in clock_hz units */
+};
+
+/* Input conversion, every stage of the database, output conversion */
+#define DSP_PROFILE_MAX_STAGES 16
+
+struct dsp_profile
+{
+    uint32_t clock_hz;  /* rate of the profiling clock, 0 if there is none
+                           and only calls and samples are counted */
+    int count;          /* number of valid entries in stage[] */
+    struct dsp_profile_stage stage[DSP_PROFILE_MAX_STAGES];
+};
+
 /* Change DSP settings */
 intptr_t dsp_configure(struct dsp_config *dsp, unsigned int setting,
                        intptr_t value);
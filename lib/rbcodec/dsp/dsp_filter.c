@@ -24,6 +24,7 @@
 #include "dsp_filter.h"
 #include "replaygain.h"
 #include <string.h>
+#include <stddef.h>
 
 enum filter_shift
 {
@@ -277,31 +278,102 @@ void filter_flush(struct dsp_filter *f)
  * form 1 was chosen because of better numerical properties for fixed point
  * implementations.
  */
-#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM)) || defined(CPU_ARM_MICRO)
-void filter_process(struct dsp_filter *f, int32_t * const buf[], int count,
-                    unsigned int channels)
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct dsp_filter, coefs) == 0x00 &&
+               offsetof(struct dsp_filter, history[0]) == 0x14 &&
+               offsetof(struct dsp_filter, history[1]) == 0x24 &&
+               offsetof(struct dsp_filter, shift) == 0x34,
+               "dsp_mips.S: dsp_filter");
+#endif /* DSP_MIPS_ASM */
+
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)) || \
+    defined(CPU_ARM_MICRO)
+/* Direct form 1 filtering code.
+   y[n] = b0*x[i] + b1*x[i - 1] + b2*x[i - 2] + a1*y[i - 1] + a2*y[i - 2],
+   where y[] is output and x[] is input.
+ */
+static FORCE_INLINE int32_t filter_sample(const int32_t coefs[5],
+                                          unsigned int shift,
+                                          int32_t history[4], int32_t x)
 {
-    /* Direct form 1 filtering code.
-       y[n] = b0*x[i] + b1*x[i - 1] + b2*x[i - 2] + a1*y[i - 1] + a2*y[i - 2],
-       where y[] is output and x[] is input.
-     */
-    unsigned int shift = f->shift;
+    long long acc = (long long) x * coefs[0];
+    acc += (long long) history[0] * coefs[1];
+    acc += (long long) history[1] * coefs[2];
+    acc += (long long) history[2] * coefs[3];
+    acc += (long long) history[3] * coefs[4];
+    history[1] = history[0];
+    history[0] = x;
+    history[3] = history[2];
+    history[2] = (acc << shift) >> 32;
+    return history[2];
+}
+
+/**
+ * Each sample goes through all of the filters before the next one is read,
+ * so the buffer is only streamed through once whatever the filter count.
+ * Stereo shares the coefficient loads between both channels, whose histories
+ * sit next to each other in the filter. The result is identical to calling
+ * filter_process() for each filter in turn.
+ */
+void filter_process_cascade(struct dsp_filter * const f[], int num_filters,
+                            int32_t * const buf[], int count,
+                            unsigned int channels)
+{
+    if (channels == 2) {
+        int32_t *left = buf[0], *right = buf[1];
+
+        for (int i = 0; i < count; i++) {
+            int32_t l = left[i], r = right[i];
+
+            for (int n = 0; n < num_filters; n++) {
+                struct dsp_filter *flt = f[n];
+                const int32_t coefs[5] = {
+                    flt->coefs[0], flt->coefs[1], flt->coefs[2],
+                    flt->coefs[3], flt->coefs[4]
+                };
+                unsigned int shift = flt->shift;
+
+                l = filter_sample(coefs, shift, flt->history[0], l);
+                r = filter_sample(coefs, shift, flt->history[1], r);
+            }
+
+            left[i] = l;
+            right[i] = r;
+        }
+
+        return;
+    }
 
     for (unsigned int c = 0; c < channels; c++) {
+        int32_t *samples = buf[c];
+
         for (int i = 0; i < count; i++) {
-            long long acc = (long long) buf[c][i] * f->coefs[0];
-            acc += (long long) f->history[c][0] * f->coefs[1];
-            acc += (long long) f->history[c][1] * f->coefs[2];
-            acc += (long long) f->history[c][2] * f->coefs[3];
-            acc += (long long) f->history[c][3] * f->coefs[4];
-            f->history[c][1] = f->history[c][0];
-            f->history[c][0] = buf[c][i];
-            f->history[c][3] = f->history[c][2];
-            buf[c][i] = (acc << shift) >> 32;
-            f->history[c][2] = buf[c][i];
+            int32_t x = samples[i];
+
+            for (int n = 0; n < num_filters; n++)
+                x = filter_sample(f[n]->coefs, f[n]->shift,
+                                  f[n]->history[c], x);
+
+            samples[i] = x;
         }
     }
 }
+
+void filter_process(struct dsp_filter *f, int32_t * const buf[], int count,
+                    unsigned int channels)
+{
+    filter_process_cascade(&f, 1, buf, count, channels);
+}
+#else /* CPU */
+/* The single filter assembly versions are used in turn */
+void filter_process_cascade(struct dsp_filter * const f[], int num_filters,
+                            int32_t * const buf[], int count,
+                            unsigned int channels)
+{
+    for (int n = 0; n < num_filters; n++)
+        filter_process(f[n], buf, count, channels);
+}
 #endif /* CPU */
 
 /* ring buffer */
@@ -51,6 +51,10 @@ void filter_copy(struct dsp_filter *dst, const struct dsp_filter *src);
 void filter_flush(struct dsp_filter *f);
 void filter_process(struct dsp_filter *f, int32_t * const buf[], int count,
                     unsigned int channels);
+/* Run several filters in series, all of them per sample */
+void filter_process_cascade(struct dsp_filter * const f[], int num_filters,
+                            int32_t * const buf[], int count,
+                            unsigned int channels);
 /* ring buffer */
 void enqueue(int32_t var, int32_t* buffer, int *head, int boundary);
 int32_t dequeue(int32_t* buffer, int *head, int boundary);
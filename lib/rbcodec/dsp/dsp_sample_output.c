@@ -26,6 +26,7 @@
 #include "dsp_proc_entry.h"
 #include "dsp-util.h"
 #include <string.h>
+#include <stddef.h>
 
 #if 0
 #include <debug.h>
@@ -44,7 +45,7 @@ void sample_output_dithered(struct sample_io_data *this,
 
 /** Sample output **/
 
-#if !defined(CPU_COLDFIRE) && !defined(CPU_ARM)
+#if !defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)
 /* write mono internal format to output format */
 void sample_output_mono(struct sample_io_data *this,
                         struct dsp_buffer *src, struct dsp_buffer *dst)
@@ -65,7 +66,8 @@ void sample_output_mono(struct sample_io_data *this,
 }
 #endif /* CPU */
 
-#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM)) || defined(CPU_ARM_MICRO)
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)) || \
+    defined(CPU_ARM_MICRO)
 /* write stereo internal format to output format */
 void sample_output_stereo(struct sample_io_data *this,
                           struct dsp_buffer *src, struct dsp_buffer *dst)
@@ -103,47 +105,68 @@ static struct dither_data
                         /* 24h */
 } dither_data IBSS_ATTR;
 
-void sample_output_dithered(struct sample_io_data *this,
-                            struct dsp_buffer *src, struct dsp_buffer *dst)
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct sample_io_data, outcount) == 0x00,
+               "dsp_mips.S: sample_io_data.outcount");
+_Static_assert(offsetof(struct dither_state, error) == 0x00 &&
+               offsetof(struct dither_state, random) == 0x0c,
+               "dsp_mips.S: dither_state");
+#endif /* DSP_MIPS_ASM */
+
+/* Dithers one channel into every other sample of d. May be implemented in
+   here or externally. */
+void sample_output_dither_channel(struct dither_state *dither,
+                                  const int32_t *s, int16_t *d,
+                                  int count, int scale);
+
+#if !defined(DSP_MIPS_ASM)
+void sample_output_dither_channel(struct dither_state *dither,
+                                  const int32_t *s, int16_t *d,
+                                  int count, int scale)
 {
-    int count = this->outcount;
-    int channels = src->format.num_channels;
-    int scale = src->format.output_scale;
     int32_t dc_bias = 1L << (scale - 1); /* 1/2 bit of significance */
     int32_t mask = (1L << scale) - 1; /* Mask of bits quantized away */
 
-    for (int ch = 0; ch < channels; ch++)
+    for (int i = 0; i < count; i++, s++, d += 2)
     {
-        struct dither_state *dither = &dither_data.state[ch];
+        /* Noise shape and bias (for correct rounding later) */
+        int32_t sample = *s;
 
-        const int32_t *s = src->p32[ch];
-        int16_t *d = &dst->p16out[ch];
+        sample += dither->error[0] - dither->error[1] + dither->error[2];
+        dither->error[2] = dither->error[1];
+        dither->error[1] = dither->error[0] / 2;
 
-        for (int i = 0; i < count; i++, s++, d += 2)
-        {
-            /* Noise shape and bias (for correct rounding later) */
-            int32_t sample = *s;
+        int32_t output = sample + dc_bias;
 
-            sample += dither->error[0] - dither->error[1] + dither->error[2];
-            dither->error[2] = dither->error[1];
-            dither->error[1] = dither->error[0] / 2;
+        /* Dither, highpass triangle PDF */
+        int32_t random = dither->random*0x0019660dL + 0x3c6ef35fL;
+        output += (random & mask) - (dither->random & mask);
+        dither->random = random;
 
-            int32_t output = sample + dc_bias;
+        /* Quantize sample to output range */
+        output >>= scale;
 
-            /* Dither, highpass triangle PDF */
-            int32_t random = dither->random*0x0019660dL + 0x3c6ef35fL;
-            output += (random & mask) - (dither->random & mask);
-            dither->random = random;
+        /* Error feedback of quantization */
+        dither->error[0] = sample - (output << scale);
 
-            /* Quantize sample to output range */
-            output >>= scale;
+        /* Clip and store */
+        *d = clip_sample_16(output);
+    }
+}
+#endif /* CPU */
 
-            /* Error feedback of quantization */
-            dither->error[0] = sample - (output << scale);
+void sample_output_dithered(struct sample_io_data *this,
+                            struct dsp_buffer *src, struct dsp_buffer *dst)
+{
+    int count = this->outcount;
+    int channels = src->format.num_channels;
+    int scale = src->format.output_scale;
 
-            /* Clip and store */
-            *d = clip_sample_16(output);
-        }
+    for (int ch = 0; ch < channels; ch++)
+    {
+        sample_output_dither_channel(&dither_data.state[ch], src->p32[ch],
+                                     &dst->p16out[ch], count, scale);
     }
 
     if (channels > 1)
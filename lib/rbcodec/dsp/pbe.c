@@ -43,6 +43,11 @@ static int32_t tcoef1, tcoef2, tcoef3;
 static int b0_r[2],b2_r[2],b3_r[2],b0_w[2],b2_w[2],b3_w[2];
 int32_t temp_buffer;
 static struct dsp_filter pbe_filter[5];
+static struct dsp_filter * const pbe_chain[5] =
+{
+    &pbe_filter[0], &pbe_filter[1], &pbe_filter[2], &pbe_filter[3],
+    &pbe_filter[4]
+};
 static int handle = -1;
 
 #define PBE_BUFSIZE ((B0_SIZE + B2_SIZE + B3_SIZE)*2*sizeof(int32_t))
@@ -188,9 +193,8 @@ static void pbe_process(struct dsp_proc_entry *this,
     }
 
     /* apply Biophonic EQ   */
-    for (int i = 0; i < 5; i++)
-        filter_process(&pbe_filter[i], buf->p32, buf->remcount,
-                       buf->format.num_channels);
+    filter_process_cascade(pbe_chain, 5, buf->p32, buf->remcount,
+                           buf->format.num_channels);
 
     (void)this;
 }
@@ -28,6 +28,7 @@
 #include "dsp_misc.h"
 #include "resample.h"
 #include <string.h>
+#include <stddef.h>
 
 /**
  * Linear interpolation resampling that introduces a one sample delay because
@@ -56,8 +57,28 @@ static struct resample_data
     unsigned int frequency_out;     /* Resampler output samplerate */
     struct dsp_buffer resample_buf; /* Buffer descriptor for resampled data */
     int32_t *resample_out_p[2];     /* Actual output buffer pointers */
+    unsigned int poly_phases;       /* L for an exact L:M ratio, else 0 */
+    unsigned int poly_step;         /* M: input samples per L outputs */
 } resample_data[DSP_COUNT] IBSS_ATTR;
 
+#ifdef DSP_MIPS_ASM
+/* Offsets hard-coded in dsp_mips.S */
+_Static_assert(offsetof(struct resample_data, delta) == 0x00 &&
+               offsetof(struct resample_data, phase) == 0x04 &&
+               offsetof(struct resample_data, history[0]) == 0x08 &&
+               offsetof(struct resample_data, history[1]) == 0x14,
+               "dsp_mips.S: resample_data");
+#endif /* DSP_MIPS_ASM */
+
+/* Most output phases of an exact ratio that gets the polyphase path: 44.1kHz
+ * to 48kHz makes 160 outputs from 147 inputs, 48kHz to 44.1kHz 147 from 160 */
+#define RESAMPLE_POLY_MAX_PHASES 160
+
+/* Spline weights of x3, x2, x1 and x0 in s1.30 for each of the phases of
+ * the audio DSP's ratio; the voice DSP always uses resample_hermite() */
+static int32_t resample_poly_coefs[RESAMPLE_POLY_MAX_PHASES][4];
+static unsigned int resample_poly_coefs_phases;
+
 /* Actual worker function. Implemented here or in target assembly code. */
 int resample_hermite(struct resample_data *data, struct dsp_buffer *src,
                      struct dsp_buffer *dst);
@@ -75,11 +96,43 @@ static void resample_flush(struct dsp_proc_entry *this)
     resample_flush_data(data);
 }
 
+/* Fill in the weights of the Hermite spline used by resample_hermite() at
+ * each of the positions i/phases between x2 and x1 */
+static void resample_poly_init_coefs(unsigned int phases)
+{
+    if (resample_poly_coefs_phases == phases)
+        return;
+
+    long long n = phases;
+    long long den = 2*n*n*n;
+
+    for (unsigned int i = 0; i < phases; i++)
+    {
+        long long p = i;
+        long long num[4] =
+        {
+            -p*n*n + 2*p*p*n - p*p*p,         /* x3 */
+            2*n*n*n - 5*p*p*n + 3*p*p*p,      /* x2 */
+            p*n*n + 4*p*p*n - 3*p*p*p,        /* x1 */
+            -p*p*n + p*p*p,                   /* x0 */
+        };
+
+        for (int k = 0; k < 4; k++)
+        {
+            long long w = num[k] * (1LL << 30);
+            resample_poly_coefs[i][k] = (w + (w < 0 ? -den : den) / 2) / den;
+        }
+    }
+
+    resample_poly_coefs_phases = phases;
+}
+
 static bool resample_new_delta(struct resample_data *data,
                                struct sample_format *format,
                                unsigned int fout)
 {
     unsigned int frequency = format->frequency; /* virtual samplerate */
+    unsigned int phases = 0, step = 0;
 
     data->frequency = frequency;
     data->frequency_out = fout;
@@ -90,14 +143,57 @@ static bool resample_new_delta(struct resample_data *data,
         /* NOTE: If fully glitch-free transistions from no resampling to
            resampling are desired, history should be maintained even when
            not resampling. */
+        data->poly_phases = 0;
         resample_flush_data(data);
         return false;
     }
 
+    if (data == &resample_data[CODEC_IDX_AUDIO])
+    {
+        /* Reduce to the exact ratio of phases:step */
+        unsigned int a = frequency, b = fout;
+
+        while (b != 0)
+        {
+            unsigned int r = a % b;
+            a = b;
+            b = r;
+        }
+
+        if (fout / a <= RESAMPLE_POLY_MAX_PHASES)
+        {
+            phases = fout / a;
+            step = frequency / a;
+        }
+    }
+
+    if (phases != data->poly_phases)
+    {
+        /* Carry the fractional position over to the new phase format */
+        uint32_t frac = data->phase & 0xffff;
+
+        if (data->poly_phases > 1)
+            frac = (frac << 16) / data->poly_phases;
+        else if (data->poly_phases == 1)
+            frac = 0;
+
+        if (phases > 0)
+            frac = (frac * phases) >> 16;
+
+        data->phase = (data->phase & ~0xffff) | frac;
+    }
+
+    if (phases > 0)
+        resample_poly_init_coefs(phases);
+
+    data->poly_phases = phases;
+    data->poly_step = step;
+
     return true;
 }
 
-#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM)) || defined(CPU_ARM_MICRO)
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM) && !defined(DSP_MIPS_ASM)) || \
+    defined(CPU_ARM_MICRO)
 int resample_hermite(struct resample_data *data, struct dsp_buffer *src,
                      struct dsp_buffer *dst)
 {
@@ -189,6 +285,117 @@ int resample_hermite(struct resample_data *data, struct dsp_buffer *src,
 }
 #endif /* CPU */
 
+/* Evaluate the spline at one phase of the exact ratio */
+static FORCE_INLINE int32_t resample_poly_sample(const int32_t w[4],
+                                                 int32_t x3, int32_t x2,
+                                                 int32_t x1, int32_t x0)
+{
+    long long acc = (long long)x3 * w[0];
+    acc += (long long)x2 * w[1];
+    acc += (long long)x1 * w[2];
+    acc += (long long)x0 * w[3];
+    return acc >> 30;
+}
+
+/* Same interface and phase handling as resample_hermite() for an exact
+ * ratio of phases outputs to step inputs. The phase accumulator holds the
+ * index of the phase in place of a fraction, and the weights of each phase
+ * come from the table so that the spline costs four multiplies. Integer
+ * decimation always lands on x2 and just copies it. */
+static int resample_poly(struct resample_data *data, struct dsp_buffer *src,
+                         struct dsp_buffer *dst)
+{
+    int ch = src->format.num_channels - 1;
+    uint32_t count = MIN(src->remcount, 0x8000);
+    unsigned int phases = data->poly_phases;
+    uint32_t step_pos = data->poly_step / phases;
+    uint32_t step_idx = data->poly_step % phases;
+    uint32_t pos, idx, end;
+    int32_t *d;
+
+    do
+    {
+        const int32_t *s = src->p32[ch];
+        int32_t *h = data->history[ch];
+
+        d = dst->p32[ch];
+        int32_t *dmax = d + dst->bufcount;
+
+        /* Restore state */
+        pos = data->phase >> 16;
+        idx = data->phase & 0xffff;
+
+        /* Outputs that still reach into the previous frame; position k is
+         * h[k] below 3 and s[k - 3] above */
+        while (pos < 3 && pos < count && d < dmax)
+        {
+            int32_t x[4];
+
+            for (int k = 0; k < 4; k++)
+                x[k] = pos + k < 3 ? h[pos + k] : s[pos + k - 3];
+
+            *d++ = resample_poly_sample(resample_poly_coefs[idx],
+                                        x[0], x[1], x[2], x[3]);
+
+            pos += step_pos;
+            idx += step_idx;
+            if (idx >= phases)
+            {
+                idx -= phases;
+                pos++;
+            }
+        }
+
+        if (phases == 1)
+        {
+            while (pos < count && d < dmax)
+            {
+                *d++ = s[pos - 2];
+                pos += step_pos;
+            }
+        }
+        else
+        {
+            while (pos < count && d < dmax)
+            {
+                const int32_t *x = &s[pos - 3];
+
+                *d++ = resample_poly_sample(resample_poly_coefs[idx],
+                                            x[0], x[1], x[2], x[3]);
+
+                pos += step_pos;
+                idx += step_idx;
+                if (idx >= phases)
+                {
+                    idx -= phases;
+                    pos++;
+                }
+            }
+        }
+
+        end = MIN(pos, count);
+
+        /* Save delay samples for next time */
+        int32_t x[3];
+
+        for (int k = 0; k < 3; k++)
+            x[k] = end + k < 3 ? h[end + k] : s[end + k - 3];
+
+        h[0] = x[0];
+        h[1] = x[1];
+        h[2] = x[2];
+
+        /* Keep any overshoot of the frame for the next one */
+        pos -= end;
+    }
+    while (--ch >= 0);
+
+    data->phase = (pos << 16) | idx;
+
+    dst->remcount = d - dst->p32[0];
+    return end;
+}
+
 /* Resample count stereo samples or stop when the destination is full.
  * Updates the src buffer and changes to its own output buffer to refer to
  * the resampled data. */
@@ -212,7 +419,9 @@ static void resample_process(struct dsp_proc_entry *this,
     {
         dst->bufcount = RESAMPLE_BUF_COUNT;
 
-        int consumed = resample_hermite(data, src, dst);
+        int consumed = data->poly_phases ?
+                       resample_poly(data, src, dst) :
+                       resample_hermite(data, src, dst);
 
         /* Advance src by consumed amount */
         if (consumed > 0)
@@ -159,7 +159,12 @@ struct tag_resolver {
     bool binary;
 };
 
+#ifdef DBTOOL
+/* the host tools parse several files concurrently */
+static __thread bool global_ff_found;
+#else
 static bool global_ff_found;
+#endif
 
 #define unsynchronize id3_unsynchronize
 int id3_unsynchronize(char* tag, int len, bool *ff_found)
@@ -0,0 +1,188 @@
+#!/usr/bin/env perl
+#             __________               __   ___.
+#   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+#   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+#   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+#   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+#                     \/            \/     \/    \/            \/
+# $Id$
+#
+# Runs warble over a fixed set of generated WAV files with different DSP
+# stages enabled, and compares the checksum of the DSP output with the
+# references in dsp_regress.ref. The stages are fixed point, so any change
+# in their arithmetic shows up as a mismatch.
+#
+# The inputs are generated with integer arithmetic only, so they are the
+# same on every host.
+#
+# Usage: dsp_regress.pl [-u] WARBLE [ARGS...]
+#   WARBLE  warble binary, e.g. build/warble.<target>, or a command that
+#           runs it, e.g. qemu-mipsel -L <sysroot> build/warble.<target>
+#   -u      rewrite dsp_regress.ref from the output of WARBLE
+#
+# Only rewrite the references from a build whose output is known to be
+# right: the references of the filter stages were made with the
+# filter_process() loop that ran once per band, before the cascaded filter
+# kernel, and the others with the generic C code. Assembly versions of the
+# stages must match them bit for bit.
+
+use strict;
+use warnings;
+use File::Basename;
+use File::Spec;
+use File::Temp qw(tempdir);
+
+my %inputs = (
+    # name => rate, channels, seconds
+    stereo44 => [ 44100, 2, 3 ],
+    mono44   => [ 44100, 1, 2 ],
+    stereo88 => [ 88200, 2, 2 ],
+    stereo48 => [ 48000, 2, 2 ],
+    mono48   => [ 48000, 1, 2 ],
+    stereo22 => [ 22050, 2, 2 ],
+);
+
+my @tests = (
+    # Filter stages. 44.1 kHz doesn't resample, and 2:1 decimation gives
+    # the same output on the Hermite and the polyphase resampler paths.
+    [ [ "stereo44", "mono44", "stereo88" ],
+      [ "eq=60,30,0,-20,0,0,20,0,-30,40",
+        "eq=-120,-60,0,0,0,0,0,0,60,120",
+        "bass=6",
+        "treble=-6",
+        "bass=-4:treble=8",
+        "pbe=50",
+        "pbe=100",
+        "afr=1",
+        "afr=3",
+        "eq=60,30,0,-20,0,0,20,0,-30,40:bass=4:treble=-3:pbe=100:afr=2" ] ],
+    # Resampler (polyphase, and Hermite for rate=), channel modes,
+    # crossfeed, dither and the sample output
+    [ [ "stereo44", "stereo48", "mono48", "stereo22" ],
+      [ "dither=0",
+        "dither=1",
+        "rate=1.1",
+        "rate=0.93:dither=1",
+        "channels=1",
+        "channels=2:width=60",
+        "channels=2:width=150",
+        "channels=5",
+        "crossfeed=1",
+        "crossfeed=2" ] ],
+);
+
+my $update = 0;
+if (@ARGV && $ARGV[0] eq "-u") {
+    $update = 1;
+    shift @ARGV;
+}
+die "Usage: $0 [-u] WARBLE [ARGS...]\n" if !@ARGV;
+my @warble = @ARGV;
+
+my $reffile = dirname($0) . "/dsp_regress.ref";
+my $tmpdir = tempdir("dsp_regress.XXXXXX", TMPDIR => 1, CLEANUP => 1);
+
+# 16-bit PCM: a square wave, a sawtooth sweep and noise from a 16-bit LCG,
+# at half scale so boosts of up to 6 dB don't clip all the time
+sub write_wav {
+    my ($path, $rate, $channels, $seconds) = @_;
+    my $frames = $rate * $seconds;
+    my $seed = 12345;
+    my $saw = 0;
+    my $data = "";
+
+    for (my $i = 0; $i < $frames; $i++) {
+        my $period = int($rate / 110);
+        my $square = ($i % $period) < $period / 2 ? 4000 : -4000;
+        my $step = 16 + int(4096 * $i / $frames);
+
+        $saw = ($saw + $step) % 16384;
+        for (my $ch = 0; $ch < $channels; $ch++) {
+            $seed = ($seed * 25173 + 13849) % 65536;
+            my $noise = ($seed >> 3) - 4096;
+            my $s = $square + ($ch ? 8192 - $saw : $saw - 8192) + $noise;
+            $data .= pack("v", $s & 0xffff);
+        }
+    }
+
+    open(my $fh, ">", $path) or die "$path: $!\n";
+    binmode($fh);
+    print $fh "RIFF", pack("V", 36 + length($data)), "WAVE";
+    print $fh "fmt ", pack("VvvVVvv", 16, 1, $channels, $rate,
+                           $rate * $channels * 2, $channels * 2, 16);
+    print $fh "data", pack("V", length($data)), $data;
+    close($fh);
+}
+
+# checksum of the DSP output, from the benchmark CSV of warble -b 1
+sub run_warble {
+    my ($input, $config) = @_;
+    my $sum;
+
+    # warble logs every codec load to stderr
+    open(my $olderr, ">&", \*STDERR) or die "stderr: $!\n";
+    open(STDERR, ">", File::Spec->devnull()) or die "stderr: $!\n";
+    my $ok = open(my $fh, "-|", @warble, "-b", "1", "-c", $config, $input);
+    my $err = $!;
+    open(STDERR, ">&", $olderr) or die "stderr: $!\n";
+    die "$warble[0]: $err\n" unless $ok;
+    while (<$fh>) {
+        chomp;
+        my @f = split(/,/);
+        $sum = $f[10] if @f == 11 && $f[1] eq "1" && $f[3] eq "1";
+    }
+    close($fh);
+    die "@warble failed on $input with $config\n" unless defined $sum;
+    return $sum;
+}
+
+my %ref;
+if (!$update) {
+    open(my $fh, "<", $reffile) or die "$reffile: $!\n";
+    while (<$fh>) {
+        next if /^\s*(#|$)/;
+        my ($name, $config, $sum) = split;
+        $ref{"$name $config"} = $sum;
+    }
+    close($fh);
+}
+
+my @results;
+my $failed = 0;
+for my $test (@tests) {
+    my ($names, $configs) = @$test;
+
+    for my $name (@$names) {
+        my $path = "$tmpdir/$name.wav";
+
+        write_wav($path, @{$inputs{$name}}) unless -e $path;
+        for my $config (@$configs) {
+            my $sum = run_warble($path, $config);
+            my $key = "$name $config";
+
+            push @results, "$key $sum\n";
+            next if $update;
+            if (!defined $ref{$key}) {
+                print "MISSING $key\n";
+                $failed++;
+            } elsif ($ref{$key} ne $sum) {
+                print "FAIL    $key: $sum, expected $ref{$key}\n";
+                $failed++;
+            } else {
+                print "ok      $key\n";
+            }
+        }
+    }
+}
+
+if ($update) {
+    open(my $fh, ">", $reffile) or die "$reffile: $!\n";
+    print $fh "# input config checksum, written by dsp_regress.pl -u\n";
+    print $fh @results;
+    close($fh);
+    print "wrote ", scalar(@results), " checksums to $reffile\n";
+    exit 0;
+}
+
+printf "%d of %d failed\n", $failed, scalar(@results);
+exit($failed ? 1 : 0);
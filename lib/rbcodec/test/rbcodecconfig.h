@@ -1,2 +1,23 @@
+#ifndef WARBLE_RBCODECCONFIG_H
+#define WARBLE_RBCODECCONFIG_H
+
 #include "../rbcodecconfig-example.h"
 #include "system.h"
+
+#ifndef __ASSEMBLER__
+/* clock_gettime */
+#include <time.h>
+
+static inline uint32_t dsp_profile_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+}
+
+/* Clock for the per-stage DSP profile */
+#define DSP_PROFILE_CLOCK()     dsp_profile_clock()
+#define DSP_PROFILE_CLOCK_HZ    1000000000
+#endif
+
+#endif
@@ -30,12 +30,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include "buffering.h" /* TYPE_PACKET_AUDIO */
 #include "kernel.h"
 #include "core_alloc.h"
 #include "codecs.h"
+#include "crc32.h"
 #include "dsp_core.h"
+#include "eq.h"
+#include "tone_controls.h"
+#include "pbe.h"
+#include "afr.h"
+#include "channel_mode.h"
+#include "crossfeed.h"
 #include "metadata.h"
 #include "settings.h"
 #include "sound.h"
@@ -97,9 +105,10 @@ off_t filesize(int fd)
 
 /***************** INTERNAL *****************/
 
-static enum { MODE_PLAY, MODE_WRITE } mode;
+static enum { MODE_PLAY, MODE_WRITE, MODE_BENCH } mode;
 static bool use_dsp = true;
 static bool enable_loop = false;
+static bool dsp_profile = false;
 static const char *config = "";
 
 /* Volume control */
@@ -379,11 +388,124 @@ static void playback_pcm(int16_t *pcm, int count)
     }
 }
 
+/***** MODE_BENCH *****/
+
+/* MODE_BENCH decodes each input from memory several times, with and without
+ * the DSP, and reports how long that took. The output is only checksummed
+ * so that runs (and builds) can be checked against each other. */
+
+struct bench_result {
+    const char *file;
+    bool dsp;
+    int runs;
+    bool ok;            /* no run returned a codec error */
+    bool stable;        /* every run produced the same output */
+    double audio;       /* seconds of audio decoded by one run */
+    double time;        /* decode time of all runs */
+    double min_time;    /* fastest run */
+    size_t peak_buffer; /* bytes of codec_get_buffer() written */
+    uint32_t crc;       /* of the output of the first run */
+};
+
+static int bench_runs;
+static bool bench_json = false;
+static uint32_t bench_crc;
+
+static void bench_pcm(const void *pcm, size_t size)
+{
+    bench_crc = crc_32(pcm, size, bench_crc);
+}
+
+static void bench_print_string(const char *str)
+{
+    putchar('"');
+    for (; *str; str++) {
+        if (*str == '"')
+            fputs(bench_json ? "\\\"" : "\"\"", stdout);
+        else if (*str == '\\' && bench_json)
+            fputs("\\\\", stdout);
+        else
+            putchar(*str);
+    }
+    putchar('"');
+}
+
+static void bench_print_result(const struct bench_result *res, bool first)
+{
+    double mean = res->runs ? res->time / res->runs : 0;
+    double rtf = res->time > 0 ? res->audio * res->runs / res->time : 0;
+
+    if (bench_json) {
+        printf("%s    { \"file\": ", first ? "" : ",\n");
+        bench_print_string(res->file);
+        printf(", \"dsp\": %s, \"runs\": %d, \"ok\": %s, \"stable\": %s, "
+               "\"audio_s\": %.3f, \"mean_s\": %.6f, \"min_s\": %.6f, "
+               "\"realtime\": %.2f, \"peak_buffer\": %zu, "
+               "\"checksum\": \"%08x\" }",
+               res->dsp ? "true" : "false", res->runs,
+               res->ok ? "true" : "false", res->stable ? "true" : "false",
+               res->audio, mean, res->min_time, rtf, res->peak_buffer,
+               (unsigned)res->crc);
+    } else {
+        if (first)
+            printf("file,dsp,runs,ok,stable,audio_s,mean_s,min_s,realtime,"
+                   "peak_buffer,checksum\n");
+        bench_print_string(res->file);
+        printf(",%d,%d,%d,%d,%.3f,%.6f,%.6f,%.2f,%zu,%08x\n",
+               res->dsp, res->runs, res->ok, res->stable, res->audio, mean,
+               res->min_time, rtf, res->peak_buffer, (unsigned)res->crc);
+    }
+}
+
+static void bench_print_total(double audio, double time, int files)
+{
+    double rtf = time > 0 ? audio / time : 0;
+
+    if (bench_json)
+        printf("\n  ],\n  \"total\": { \"files\": %d, \"audio_s\": %.3f, "
+               "\"decode_s\": %.6f, \"realtime\": %.2f }\n}\n",
+               files, audio, time, rtf);
+    else
+        printf("\"total\",,%d,,,%.3f,%.6f,,%.2f,,\n", files, audio, time, rtf);
+}
+
 /***** ALL MODES *****/
 
+static int tone_bass, tone_treble;
+
+/* Same bands as the default equalizer settings */
+static void set_eq(const char *val)
+{
+    static const struct eq_band_setting bands[EQ_NUM_BANDS] = {
+        { 32, 7, 0 }, { 64, 10, 0 }, { 125, 10, 0 }, { 250, 10, 0 },
+        { 500, 10, 0 }, { 1000, 10, 0 }, { 2000, 10, 0 }, { 4000, 10, 0 },
+        { 8000, 10, 0 }, { 16000, 7, 0 },
+    };
+    int precut = 0;
+
+    for (int i = 0; i < EQ_NUM_BANDS; i++) {
+        struct eq_band_setting band = bands[i];
+        char *end;
+
+        band.gain = strtol(val, &end, 10);
+        val = *end == ',' ? end + 1 : end;
+        precut = MAX(precut, band.gain);
+        dsp_set_eq_coefs(i, &band);
+    }
+
+    dsp_set_eq_precut(precut);
+    dsp_eq_enable(true);
+}
+
+static void set_tone(void)
+{
+    tone_set_bass(tone_bass * 10);
+    tone_set_treble(tone_treble * 10);
+    tone_set_prescale(MAX(MAX(tone_bass, tone_treble), 0) * 10);
+}
+
 static void perform_config(void)
 {
-    /* TODO: equalizer, etc. */
     while (config) {
         const char *name = config;
         const char *eq = strchr(config, '=');
@@ -395,8 +517,22 @@ static void perform_config(void)
         if (!strncmp(name, "wait=", 5)) {
             if (atoi(val) > num_output_samples)
                 return;
+        } else if (!strncmp(name, "afr=", 4)) {
+            dsp_afr_enable(atoi(val));
+        } else if (!strncmp(name, "bass=", 5)) {
+            tone_bass = atoi(val);
+            set_tone();
+        } else if (!strncmp(name, "channels=", 9)) {
+            channel_mode_set_config(atoi(val));
+        } else if (!strncmp(name, "crossfeed=", 10)) {
+            /* Custom crossfeed with the default settings */
+            dsp_set_crossfeed_direct_gain(-15);
+            dsp_set_crossfeed_cross_params(-60, -160, 700);
+            dsp_set_crossfeed_type(atoi(val));
         } else if (!strncmp(name, "dither=", 7)) {
             dsp_dither_enable(atoi(val) ? true : false);
+        } else if (!strncmp(name, "eq=", 3)) {
+            set_eq(val);
         } else if (!strncmp(name, "halt=", 5)) {
             if (atoi(val))
                 codec_action = CODEC_ACTION_HALT;
@@ -404,6 +540,12 @@ static void perform_config(void)
             enable_loop = atoi(val) != 0;
         } else if (!strncmp(name, "offset=", 7)) {
             ci.id3->offset = atoi(val);
+        } else if (!strncmp(name, "pbe=", 4)) {
+            dsp_pbe_enable(atoi(val));
+        } else if (!strncmp(name, "profile=", 8)) {
+            dsp_profile = atoi(val) != 0;
+            if (use_dsp)
+                dsp_configure(ci.dsp, DSP_PROFILE_ENABLE, dsp_profile);
         } else if (!strncmp(name, "rate=", 5)) {
             dsp_set_pitch(atof(val) * PITCH_SPEED_100);
         } else if (!strncmp(name, "seek=", 5)) {
@@ -411,8 +553,13 @@ static void perform_config(void)
             codec_action_param = atoi(val);
         } else if (!strncmp(name, "tempo=", 6)) {
             dsp_set_timestretch(atof(val) * PITCH_SPEED_100);
+        } else if (!strncmp(name, "treble=", 7)) {
+            tone_treble = atoi(val);
+            set_tone();
         } else if (!strncmp(name, "vol=", 4)) {
             playback_set_volume(atoi(val));
+        } else if (!strncmp(name, "width=", 6)) {
+            channel_mode_custom_set_width(atoi(val));
         } else {
             fprintf(stderr, "error: unrecognized config \"%.*s\"\n",
                     (int)(eq - name), name);
@@ -426,6 +573,34 @@ static void perform_config(void)
     }
 }
 
+static void print_dsp_profile(FILE *f)
+{
+    struct dsp_profile prof;
+    uint64_t total = 0;
+
+    if (!use_dsp || !dsp_profile)
+        return;
+
+    dsp_configure(ci.dsp, DSP_PROFILE_GET, (intptr_t)&prof);
+    for (int i = 0; i < prof.count; i++)
+        total += prof.stage[i].clocks;
+
+    fprintf(f, "DSP profile:\n");
+    fprintf(f, "  %-14s %8s %12s %10s %6s %9s\n",
+            "stage", "calls", "samples", "ms", "%", "ns/sample");
+    for (int i = 0; i < prof.count; i++) {
+        const struct dsp_profile_stage *st = &prof.stage[i];
+        if (!st->calls && !st->active)
+            continue;
+        double ms = prof.clock_hz ? st->clocks * 1000.0 / prof.clock_hz : 0;
+        fprintf(f, "  %-14s %8lu %12llu %10.3f %6.1f %9.2f\n",
+                st->name, (unsigned long)st->calls,
+                (unsigned long long)st->samples, ms,
+                total ? st->clocks * 100.0 / total : 0.0,
+                st->samples ? ms * 1e6 / st->samples : 0.0);
+    }
+}
+
 static void *ci_codec_get_buffer(size_t *size)
 {
     static char buffer[64 * 1024 * 1024];
@@ -462,6 +637,8 @@ static void ci_pcmbuf_insert(const void *ch1, const void *ch2, int count)
                     write_pcm(buf, dst.remcount);
                 else if (mode == MODE_PLAY)
                     playback_pcm(buf, dst.remcount);
+                else if (mode == MODE_BENCH)
+                    bench_pcm(buf, dst.remcount * 4);
             } else if (src.remcount <= 0) {
                 break;
             }
@@ -495,6 +672,8 @@ static void ci_pcmbuf_insert(const void *ch1, const void *ch2, int count)
 
         if (mode == MODE_WRITE)
             write_pcm_raw(buf, count);
+        else if (mode == MODE_BENCH)
+            bench_pcm(buf, sizeof(buf));
     }
 
     perform_config();
@@ -507,6 +686,10 @@ static void ci_set_elapsed(unsigned long value)
 
 static char *input_buffer = 0;
 
+/* The whole input file, in MODE_BENCH */
+static char *input_data = NULL;
+static size_t input_size;
+
 /*
  * Read part of the input file into a provided buffer.
  *
@@ -520,6 +703,13 @@ static size_t ci_read_filebuf(void *ptr, size_t size)
     free(input_buffer);
     input_buffer = NULL;
 
+    if (input_data) {
+        size = MIN(size, input_size - ci.curpos);
+        memcpy(ptr, input_data + ci.curpos, size);
+        ci.curpos += size;
+        return size;
+    }
+
     ssize_t actual = read(input_fd, ptr, size);
     if (actual < 0)
         actual = 0;
@@ -538,8 +728,13 @@ static size_t ci_read_filebuf(void *ptr, size_t size)
 static void *ci_request_buffer(size_t *realsize, size_t reqsize)
 {
     free(input_buffer);
+    input_buffer = NULL;
     if (!rbcodec_format_is_atomic(ci.id3->codectype))
         reqsize = MIN(reqsize, 32 * 1024);
+    if (input_data) {
+        *realsize = MIN(reqsize, input_size - ci.curpos);
+        return input_data + ci.curpos;
+    }
     input_buffer = malloc(reqsize);
     *realsize = read(input_fd, input_buffer, reqsize);
     if (*realsize < 0)
@@ -559,7 +754,10 @@ static void ci_advance_buffer(size_t amount)
     free(input_buffer);
     input_buffer = NULL;
 
-    lseek(input_fd, amount, SEEK_CUR);
+    if (input_data)
+        amount = MIN(amount, input_size - ci.curpos);
+    else
+        lseek(input_fd, amount, SEEK_CUR);
     ci.curpos += amount;
     ci.id3->offset = ci.curpos;
 }
@@ -574,6 +772,11 @@ static bool ci_seek_buffer(size_t newpos)
     free(input_buffer);
     input_buffer = NULL;
 
+    if (input_data) {
+        ci.curpos = MIN(newpos, input_size);
+        return true;
+    }
+
     off_t actual = lseek(input_fd, newpos, SEEK_SET);
     if (actual >= 0)
         ci.curpos = actual;
@@ -591,19 +794,18 @@ static void ci_set_offset(size_t value)
 
 static void ci_configure(int setting, intptr_t value)
 {
-    if (use_dsp) {
-        dsp_configure(ci.dsp, setting, value);
-    } else {
-        if (setting == DSP_SET_FREQUENCY
-                || setting == DSP_SET_FREQUENCY)
-            format.freq = value;
-        else if (setting == DSP_SET_SAMPLE_DEPTH)
-            format.depth = value;
-        else if (setting == DSP_SET_STEREO_MODE) {
-            format.stereo_mode = value;
-            format.channels = (value == STEREO_MONO) ? 1 : 2;
-        }
+    /* The format is also kept with the DSP, for MODE_BENCH */
+    if (setting == DSP_SET_FREQUENCY)
+        format.freq = value;
+    else if (setting == DSP_SET_SAMPLE_DEPTH)
+        format.depth = value;
+    else if (setting == DSP_SET_STEREO_MODE) {
+        format.stereo_mode = value;
+        format.channels = (value == STEREO_MONO) ? 1 : 2;
     }
+
+    if (use_dsp)
+        dsp_configure(ci.dsp, setting, value);
 }
 
 static long ci_get_command(intptr_t *param)
@@ -759,7 +961,7 @@ static void print_mp3entry(const struct mp3entry *id3, FILE *f)
     if (id3->mb_track_id) fprintf(f, "Musicbrainz track ID: %s\n", id3->mb_track_id);
 }
 
-static void decode_file(const char *input_fn)
+static void init_dsp(void)
 {
     /* Initialize DSP before any sort of interaction */
     dsp_init();
@@ -768,27 +970,13 @@ static void decode_file(const char *input_fn)
     memset(&global_settings, 0, sizeof(global_settings));
     global_settings.timestretch_enabled = true;
     dsp_timestretch_enable(true);
+}
 
-    /* Open file */
-    if (!strcmp(input_fn, "-")) {
-        input_fd = STDIN_FILENO;
-    } else {
-        input_fd = open(input_fn, O_RDONLY);
-        if (input_fd == -1) {
-            perror(input_fn);
-            exit(1);
-        }
-    }
-
-    /* Set up ci */
-    struct mp3entry id3;
-    if (!get_metadata(&id3, input_fd, input_fn)) {
-        fprintf(stderr, "error: metadata parsing failed\n");
-        exit(1);
-    }
-    print_mp3entry(&id3, stderr);
-    ci.filesize = filesize(input_fd);
-    ci.id3 = &id3;
+static void init_ci(struct mp3entry *id3, off_t filesize)
+{
+    ci.filesize = filesize;
+    ci.curpos = 0;
+    ci.id3 = id3;
     if (use_dsp) {
         ci.dsp = dsp_get_config(CODEC_IDX_AUDIO);
         dsp_configure(ci.dsp, DSP_SET_OUT_FREQUENCY, DSP_OUT_DEFAULT_HZ);
@@ -796,18 +984,21 @@ static void decode_file(const char *input_fn)
         dsp_dither_enable(false);
     }
     perform_config();
+}
 
-    /* Load codec */
+static struct codec_header *load_codec(const struct mp3entry *id3,
+                                       void **dlcodec)
+{
     char str[MAX_PATH];
-    snprintf(str, sizeof(str), CODECDIR"/%s.codec", audio_formats[id3.codectype].codec_root_fn);
+    snprintf(str, sizeof(str), CODECDIR"/%s.codec", audio_formats[id3->codectype].codec_root_fn);
     debugf("Loading %s\n", str);
-    void *dlcodec = dlopen(str, RTLD_NOW);
-    if (!dlcodec) {
+    *dlcodec = dlopen(str, RTLD_NOW);
+    if (!*dlcodec) {
         fprintf(stderr, "error: dlopen failed: %s\n", dlerror());
         exit(1);
     }
     struct codec_header *c_hdr = NULL;
-    c_hdr = dlsym(dlcodec, "__header");
+    c_hdr = dlsym(*dlcodec, "__header");
     if (c_hdr->lc_hdr.magic != CODEC_MAGIC) {
         fprintf(stderr, "error: %s invalid: incorrect magic\n", str);
         exit(1);
@@ -820,8 +1011,14 @@ static void decode_file(const char *input_fn)
         fprintf(stderr, "error: %s invalid: incorrect API version\n", str);
         exit(1);
     }
+    return c_hdr;
+}
+
+/* Returns false on a codec error */
+static bool run_codec(struct codec_header *c_hdr)
+{
+    bool ok = true;
 
-    /* Run the codec */
     *c_hdr->api = &ci;
     if (c_hdr->entry_point(CODEC_LOAD) != CODEC_OK) {
         fprintf(stderr, "error: codec returned error from codec_main\n");
@@ -829,8 +1026,41 @@ static void decode_file(const char *input_fn)
     }
     if (c_hdr->run_proc() != CODEC_OK) {
         fprintf(stderr, "error: codec error\n");
+        ok = false;
     }
     c_hdr->entry_point(CODEC_UNLOAD);
+    return ok;
+}
+
+static void decode_file(const char *input_fn)
+{
+    init_dsp();
+
+    /* Open file */
+    if (!strcmp(input_fn, "-")) {
+        input_fd = STDIN_FILENO;
+    } else {
+        input_fd = open(input_fn, O_RDONLY);
+        if (input_fd == -1) {
+            perror(input_fn);
+            exit(1);
+        }
+    }
+
+    /* Set up ci */
+    struct mp3entry id3;
+    if (!get_metadata(&id3, input_fd, input_fn)) {
+        fprintf(stderr, "error: metadata parsing failed\n");
+        exit(1);
+    }
+    print_mp3entry(&id3, stderr);
+    init_ci(&id3, filesize(input_fd));
+
+    /* Load and run the codec */
+    void *dlcodec;
+    struct codec_header *c_hdr = load_codec(&id3, &dlcodec);
+    run_codec(c_hdr);
+    print_dsp_profile(stderr);
 
     /* Close */
     dlclose(dlcodec);
@@ -838,29 +1068,169 @@ static void decode_file(const char *input_fn)
         close(input_fd);
 }
 
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Decodes input_data bench_runs times; I/O and codec loading are not
+ * timed. The codec buffer is filled with a pattern before each run, the
+ * bytes that no longer match it afterwards give the peak buffer usage. */
+static void bench_file(const char *input_fn, const struct mp3entry *id3_orig,
+                       struct bench_result *res)
+{
+    const char *bench_config = config;
+    void *dlcodec;
+    struct codec_header *c_hdr = load_codec(id3_orig, &dlcodec);
+    size_t size;
+    char *buffer = ci_codec_get_buffer(&size);
+
+    memset(res, 0, sizeof(*res));
+    res->file = input_fn;
+    res->runs = bench_runs;
+    res->dsp = use_dsp;
+    res->ok = true;
+    res->stable = true;
+
+    for (int run = 0; run < bench_runs; run++) {
+        struct mp3entry id3 = *id3_orig;
+
+        memset(buffer, 0xa5, size);
+        config = bench_config;
+        codec_action = CODEC_ACTION_NULL;
+        num_output_samples = 0;
+        bench_crc = 0xffffffff;
+        init_ci(&id3, input_size);
+        if (use_dsp) /* drop what the last run left in the filters */
+            dsp_configure(ci.dsp, DSP_FLUSH, 0);
+        if (use_dsp && run == 0)
+            dsp_configure(ci.dsp, DSP_PROFILE_RESET, 0);
+
+        double start = now();
+        res->ok &= run_codec(c_hdr);
+        double time = now() - start;
+
+        size_t used = 0;
+        for (size_t i = 0; i < size; i++)
+            used += buffer[i] != (char)0xa5;
+
+        res->time += time;
+        if (run == 0 || time < res->min_time)
+            res->min_time = time;
+        res->peak_buffer = MAX(res->peak_buffer, used);
+        if (run == 0) {
+            long freq = format.freq ? (long)format.freq : (long)id3.frequency;
+            res->crc = bench_crc;
+            res->audio = freq ? (double)num_output_samples / freq : 0;
+        } else if (bench_crc != res->crc) {
+            res->stable = false;
+        }
+    }
+
+    config = bench_config;
+    dlclose(dlcodec);
+
+    if (dsp_profile && use_dsp) {
+        fprintf(stderr, "%s, %d runs\n", input_fn, bench_runs);
+        print_dsp_profile(stderr);
+    }
+}
+
+static void bench_files(char **files, int count)
+{
+    bool with_dsp = use_dsp;
+    double audio = 0, time = 0;
+    int results = 0;
+
+    mode = MODE_BENCH;
+    init_dsp();
+    if (bench_json)
+        printf("{\n  \"results\": [\n");
+
+    for (int i = 0; i < count; i++) {
+        struct mp3entry id3;
+        int fd = open(files[i], O_RDONLY);
+        if (fd == -1) {
+            perror(files[i]);
+            exit(1);
+        }
+        if (!get_metadata(&id3, fd, files[i])) {
+            fprintf(stderr, "error: %s: metadata parsing failed\n", files[i]);
+            exit(1);
+        }
+
+        /* Load the whole file so that I/O isn't measured */
+        input_size = filesize(fd);
+        input_data = malloc(input_size ? input_size : 1);
+        if (!input_data || lseek(fd, 0, SEEK_SET) != 0 ||
+            read(fd, input_data, input_size) != (ssize_t)input_size) {
+            fprintf(stderr, "error: %s: can't load file\n", files[i]);
+            exit(1);
+        }
+        close(fd);
+
+        /* Without the DSP, then with it unless it was disabled */
+        for (int pass = 0; pass < (with_dsp ? 2 : 1); pass++) {
+            struct bench_result res;
+            use_dsp = pass == 1;
+            bench_file(files[i], &id3, &res);
+            bench_print_result(&res, results++ == 0);
+            audio += res.audio * res.runs;
+            time += res.time;
+        }
+        use_dsp = with_dsp;
+
+        free(input_data);
+        input_data = NULL;
+    }
+
+    bench_print_total(audio, time, count);
+}
+
 static void print_help(const char *progname)
 {
     fprintf(stderr, "Usage:\n"
                     "        Play: %s [options] INPUTFILE\n"
                     "Write to WAV: %s [options] INPUTFILE OUTPUTFILE\n"
+                    "   Benchmark: %s -b RUNS [options] INPUTFILE...\n"
                     "\n"
                     "general options:\n"
                     "  -c a=1:b=2    Configuration (see below)\n"
                     "  -h            Show this help\n"
                     "\n"
+                    "benchmark options:\n"
+                    "  -b RUNS       Decode each file RUNS times from memory, without\n"
+                    "                and with the DSP, and print timings as CSV\n"
+                    "  -f, -r        Only benchmark without the DSP\n"
+                    "  -j            Print JSON instead of CSV\n"
+                    "\n"
                     "write to WAV options:\n"
                     "  -f            Write raw codec output converted to 64-bit float\n"
                     "  -r            Write raw 32-bit codec output without WAV header\n"
                     "\n"
                     "configuration:\n"
+                    "  afr=<n>       Auditory fatigue reduction strength [0]\n"
+                    "  bass=<n>      Bass tone control in dB [0]\n"
+                    "  channels=<n>  Channel configuration: 0 stereo, 1 mono,\n"
+                    "                2 custom, 3 mono left, 4 mono right,\n"
+                    "                5 karaoke [0]\n"
+                    "  crossfeed=<n> Crossfeed: 0 off, 1 Meier, 2 custom [0]\n"
                     "  dither=<0|1>  Enable/disable dithering [0]\n"
+                    "  eq=<g,g,...>  Enable the equalizer with these band gains\n"
+                    "                in 0.1 dB, default bands (32 Hz to 16 kHz)\n"
                     "  halt=<0|1>    Stop decoding if 1 [0]\n"
                     "  loop=<0|1>    Enable/disable looping [0]\n"
                     "  offset=<n>    Start at byte offset within the file [0]\n"
+                    "  pbe=<n>       Perceptual bass enhancement strength [0]\n"
+                    "  profile=<0|1> Print per-stage DSP timings to stderr [0]\n"
                     "  rate=<n>      Multiply rate by <n> [1.0]\n"
                     "  seek=<n>      Seek <n> ms into the file\n"
                     "  tempo=<n>     Timestretch by <n> [1.0]\n"
+                    "  treble=<n>    Treble tone control in dB [0]\n"
                     "  vol=<n>       Set volume attenuation to <n> dB [-0]\n"
+                    "  width=<n>     Stereo width in percent for channels=2\n"
                     "  wait=<n>      Don't apply remaining configuration until\n"
                     "                <n> total samples have output\n"
                     "\n"
@@ -869,17 +1239,32 @@ static void print_help(const char *progname)
                     "  %s in.adx -c loop=1:wait=44100:halt=1\n"
                     "  # Lower pitch 1 octave and write to out.wav\n"
                     "  %s in.ogg -c rate=0.5:tempo=2 out.wav\n"
-                    , progname, progname, progname, progname);
+                    "  # Decode each file 5 times and report the realtime factor\n"
+                    "  %s -b 5 *.flac *.mp3 > bench.csv\n"
+                    "  # Checksums to compare the DSP output of two builds\n"
+                    "  %s -b 1 -c eq=60,30,0,-20,0,0,20,0,-30,40:bass=4 in.flac\n"
+                    , progname, progname, progname, progname, progname, progname,
+                    progname);
 }
 
 int main(int argc, char **argv)
 {
     int opt;
-    while ((opt = getopt(argc, argv, "c:fhr")) != -1) {
+    while ((opt = getopt(argc, argv, "b:c:fhjr")) != -1) {
         switch (opt) {
+        case 'b':
+            bench_runs = atoi(optarg);
+            if (bench_runs <= 0) {
+                fprintf(stderr, "error: invalid number of runs\n");
+                exit(1);
+            }
+            break;
         case 'c':
             config = optarg;
             break;
+        case 'j':
+            bench_json = true;
+            break;
         case 'f':
             use_dsp = false;
             break;
@@ -894,7 +1279,18 @@ int main(int argc, char **argv)
         }
     }
 
-    if (argc == optind + 2) {
+    /* For the DSP stages that allocate their buffers */
+    core_allocator_init();
+
+    if (bench_runs > 0) {
+        if (argc == optind) {
+            fprintf(stderr, "error: no input files\n");
+            print_help(argv[0]);
+            exit(1);
+        }
+        bench_files(&argv[optind], argc - optind);
+        return 0;
+    } else if (argc == optind + 2) {
         write_init(argv[optind + 1]);
     } else if (argc == optind + 1) {
         if (!use_dsp) {
@@ -902,7 +1298,6 @@ int main(int argc, char **argv)
             print_help(argv[0]);
             exit(1);
         }
-        core_allocator_init();
         playback_init();
     } else {
         if (argc > 1)
@@ -2,7 +2,8 @@ const fs = require('fs');
 const path = require('path');
 const mm = require('music-metadata');
 
-const MAGIC = "RDB1";
+const MAGIC = "RDB3";
+const PREFIX_LEN = 8;
 const SUPPORTED_EXTS = ['.mp3', '.flac', '.ogg', '.wav', '.m4a'];
 
 // Helper class for DB Entry
@@ -20,13 +21,19 @@ class DBEntry {
     }
 }
 
+// The player's tag parser drops trailing whitespace; do the same so
+// that both generators store identical strings.
+function tagValue(value) {
+    return typeof value === 'string' ? value.replace(/\s+$/, '') : value;
+}
+
 async function getMetadata(filePath) {
     try {
         const metadata = await mm.parseFile(filePath, { skipCovers: true });
         return {
-            title: metadata.common.title,
-            artist: metadata.common.artist,
-            album: metadata.common.album
+            title: tagValue(metadata.common.title),
+            artist: tagValue(metadata.common.artist),
+            album: tagValue(metadata.common.album)
         };
     } catch (error) {
         // console.warn(`Error parsing ${filePath}:`, error.message);
@@ -79,15 +86,19 @@ async function createDatabase(musicDir, outputFile) {
 
     await scan(musicDir);
 
-    // Sort: Artist -> Album -> Title
+    // Sort: Artist -> Album -> Title, then path to break ties.
+    // Keys are ASCII case folded and compared as UTF-8 bytes so the order
+    // doesn't depend on the host locale and matches tools/rdbgen.
+    const sortKey = s => Buffer.from((s || "").replace(/[A-Z]/g, c => c.toLowerCase()), 'utf-8');
+    entries.forEach(e => {
+        e.keys = [sortKey(e.artist), sortKey(e.album), sortKey(e.title), Buffer.from(e.relPath, 'utf-8')];
+    });
     entries.sort((a, b) => {
-        const artCmp = (a.artist || "").toLowerCase().localeCompare((b.artist || "").toLowerCase());
-        if (artCmp !== 0) return artCmp;
-
-        const albCmp = (a.album || "").toLowerCase().localeCompare((b.album || "").toLowerCase());
-        if (albCmp !== 0) return albCmp;
-
-        return (a.title || "").toLowerCase().localeCompare((b.title || "").toLowerCase());
+        for (let k = 0; k < a.keys.length; k++) {
+            const cmp = Buffer.compare(a.keys[k], b.keys[k]);
+            if (cmp !== 0) return cmp;
+        }
+        return 0;
     });
 
     // String Pool
@@ -111,6 +122,10 @@ async function createDatabase(musicDir, outputFile) {
     // Build Indices
     const artistIndex = [];
     const albumIndex = [];
+    // RDB2: groups are runs sharing artist and album (an album as listed
+    // under its artist); artistGroup holds each artist's first group
+    const artistGroup = [];
+    const groups = [];
 
     let currentArtistIdx = -1;
     let currentAlbumIdx = -1;
@@ -121,28 +136,74 @@ async function createDatabase(musicDir, outputFile) {
         entry.artist_idx = addString(entry.artist);
         entry.album_idx = addString(entry.album);
 
-        if (entry.artist_idx !== currentArtistIdx) {
+        const newArtist = entry.artist_idx !== currentArtistIdx;
+        const newAlbum = entry.album_idx !== currentAlbumIdx;
+
+        if (newArtist) {
             artistIndex.push(i);
+            artistGroup.push(groups.length);
             currentArtistIdx = entry.artist_idx;
         }
 
-        if (entry.album_idx !== currentAlbumIdx) {
+        if (newAlbum) {
             albumIndex.push(i);
             currentAlbumIdx = entry.album_idx;
         }
+
+        if (newArtist || newAlbum) {
+            groups.push({ start: i, album_idx: entry.album_idx });
+        }
     });
+    artistGroup.push(groups.length);
+
+    // Track ranges: { start, count, album string }
+    const groupRanges = groups.map((g, n) => ({
+        start: g.start,
+        count: (n + 1 < groups.length ? groups[n + 1].start : entries.length) - g.start,
+        album_idx: g.album_idx
+    }));
+    const albumRanges = albumIndex.map((start, n) => ({
+        start: start,
+        count: (n + 1 < albumIndex.length ? albumIndex[n + 1] : entries.length) - start,
+        album_idx: entries[start].album_idx
+    }));
+
+    // RDB3: alphabetical (case folded) indices of artists, albums and titles
+    // for type-to-jump. Rows: first PREFIX_LEN folded bytes, item, name.
+    function prefixIndex(starts, field) {
+        const rows = starts.map((start, item) => {
+            const e = entries[start];
+            return { folded: e.keys[field], item: item, name_idx: e[['artist_idx', 'album_idx', 'title_idx'][field]] };
+        });
+        rows.sort((a, b) => Buffer.compare(a.folded, b.folded) || a.item - b.item);
+        return rows;
+    }
+    const artistPrefix = prefixIndex(artistIndex, 0);
+    const albumPrefix = prefixIndex(albumIndex, 1);
+    const titlePrefix = prefixIndex(entries.map((e, i) => i), 2);
 
     // Create Binary Buffer
-    // Header (28 bytes) + Entries (16 * N) + ArtistIdx (4 * N) + AlbumIdx (4 * N) + Pool
+    // Header (56 bytes) + Entries (16 * N) + ArtistIdx (4 * N) + AlbumIdx (4 * N)
+    // + ArtistGroup (4 * (Artists + 1)) + Groups (12 * G) + Albums (12 * A)
+    // + Prefix rows (16 * (Artists + Albums + N)) + Pool
 
-    const headerSize = 28;
+    const headerSize = 56;
     const entriesSize = entries.length * 16;
     const artistIndexSize = artistIndex.length * 4;
     const albumIndexSize = albumIndex.length * 4;
+    const artistGroupSize = artistGroup.length * 4;
+    const groupTableSize = groupRanges.length * 12;
+    const albumTableSize = albumRanges.length * 12;
 
     const artistIndexOffset = headerSize + entriesSize;
     const albumIndexOffset = artistIndexOffset + artistIndexSize;
-    const stringPoolOffset = albumIndexOffset + albumIndexSize;
+    const artistGroupOffset = albumIndexOffset + albumIndexSize;
+    const groupTableOffset = artistGroupOffset + artistGroupSize;
+    const albumTableOffset = groupTableOffset + groupTableSize;
+    const artistPrefixOffset = albumTableOffset + albumTableSize;
+    const albumPrefixOffset = artistPrefixOffset + artistPrefix.length * 16;
+    const titlePrefixOffset = albumPrefixOffset + albumPrefix.length * 16;
+    const stringPoolOffset = titlePrefixOffset + titlePrefix.length * 16;
 
     const finalSize = stringPoolOffset + currentPoolSize;
 
@@ -157,6 +218,13 @@ async function createDatabase(musicDir, outputFile) {
     offset = buf.writeUInt32LE(artistIndexOffset, offset);
     offset = buf.writeUInt32LE(albumIndexOffset, offset);
     offset = buf.writeUInt32LE(stringPoolOffset, offset);
+    offset = buf.writeUInt32LE(groupRanges.length, offset);
+    offset = buf.writeUInt32LE(artistGroupOffset, offset);
+    offset = buf.writeUInt32LE(groupTableOffset, offset);
+    offset = buf.writeUInt32LE(albumTableOffset, offset);
+    offset = buf.writeUInt32LE(artistPrefixOffset, offset);
+    offset = buf.writeUInt32LE(albumPrefixOffset, offset);
+    offset = buf.writeUInt32LE(titlePrefixOffset, offset);
 
     // 2. Entries
     entries.forEach(entry => {
@@ -176,7 +244,27 @@ async function createDatabase(musicDir, outputFile) {
         offset = buf.writeUInt32LE(idx, offset);
     });
 
-    // 5. String Pool
+    // 5. Artist -> first group
+    artistGroup.forEach(idx => {
+        offset = buf.writeUInt32LE(idx, offset);
+    });
+
+    // 6. Group and album track ranges
+    groupRanges.concat(albumRanges).forEach(r => {
+        offset = buf.writeUInt32LE(r.start, offset);
+        offset = buf.writeUInt32LE(r.count, offset);
+        offset = buf.writeUInt32LE(r.album_idx, offset);
+    });
+
+    // 7. Prefix indices (key is NUL padded; the buffer is zero filled)
+    artistPrefix.concat(albumPrefix, titlePrefix).forEach(r => {
+        r.folded.copy(buf, offset, 0, Math.min(PREFIX_LEN, r.folded.length));
+        offset += PREFIX_LEN;
+        offset = buf.writeUInt32LE(r.item, offset);
+        offset = buf.writeUInt32LE(r.name_idx, offset);
+    });
+
+    // 8. String Pool
     const poolBuf = Buffer.concat(stringPool);
     poolBuf.copy(buf, stringPoolOffset);
 
@@ -2,8 +2,12 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -17,10 +21,35 @@
 /* This is meant to be run on the root of the dap. it'll put the db files into
  * a .rockbox subdir */
 
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-j threads]\n\n"
+            "  -j threads  metadata parser threads (default: one per CPU)\n",
+            prog);
+}
+
 int main(int argc, char **argv)
 {
-    (void)argc;
-    (void)argv;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
 
     fprintf(stderr, "Rockbox database tool for '%s'\n\n", TOSTRING(TARGET_NAME));
 
@@ -36,11 +65,27 @@ int main(int argc, char **argv)
      * (with the help of sim_root_dir below */
     const char *paths[] = { "/", NULL };
     tagcache_init();
+    tagcache_set_build_threads(threads);
 
     fprintf(stderr, "Scanning files (may take some time)...\n");
 
+    double t0 = now();
     do_tagcache_build(paths);
+    double t1 = now();
     tagcache_reverse_scan();
+    double t2 = now();
+
+    struct tagcache_build_stats stats;
+    tagcache_get_build_stats(&stats);
+    double parse_time = stats.parse > 0 ? stats.parse : 1e-9;
+    fprintf(stderr, "Scan:    %ld files in %.2fs\n", stats.files, stats.scan);
+    fprintf(stderr, "Parse:   %ld files in %.2fs on %d threads (%.0f files/s)\n",
+            stats.parsed, stats.parse, stats.threads,
+            stats.parsed / parse_time);
+    fprintf(stderr, "Append:  %ld entries in %.2fs\n", stats.added, stats.append);
+    fprintf(stderr, "Commit:  %.2fs\n", stats.commit);
+    fprintf(stderr, "Reverse: %.2fs\n", t2 - t1);
+    fprintf(stderr, "Total:   %.2fs\n", t2 - t0);
 
     fprintf(stderr, "...done!\n");
 
@@ -51,21 +96,38 @@ int main(int argc, char **argv)
 /* needed for io.c */
 const char *sim_root_dir = ".";
 
-/* stubs to avoid including thread-sdl.c */
+/* stubs to avoid including thread-sdl.c; the kernel mutexes used by the
+ * codepage code all map onto one host lock as metadata is parsed on
+ * several threads */
 #include "kernel.h"
+static pthread_mutex_t kernel_lock;
+static pthread_once_t kernel_lock_once = PTHREAD_ONCE_INIT;
+
+static void kernel_lock_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&kernel_lock, &attr);
+}
+
 void mutex_init(struct mutex *m)
 {
     (void)m;
+    pthread_once(&kernel_lock_once, kernel_lock_init);
 }
 
 void mutex_lock(struct mutex *m)
 {
     (void)m;
+    pthread_once(&kernel_lock_once, kernel_lock_init);
+    pthread_mutex_lock(&kernel_lock);
 }
 
 void mutex_unlock(struct mutex *m)
 {
     (void)m;
+    pthread_mutex_unlock(&kernel_lock);
 }
 
 void sim_thread_lock(void *me)
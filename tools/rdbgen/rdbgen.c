@@ -0,0 +1,609 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/* Host-side generator for the custom database (/database.rdb) read by
+ * apps/custom_db.c. Produces the same file as pc_app/modules/db_generator.js
+ * for the same tags, but parses with the Rockbox metadata code on a pool of
+ * worker threads. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "file.h"
+#include "dir.h"
+#include "metadata.h"
+#include "custom_db.h"
+
+/* needed for io.c; top-level directory of the dap, set by -r */
+const char *sim_root_dir = ".";
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+
+/* The sim file layer has a fixed descriptor table; leave room for dirs and
+ * the odd file a parser opens on its own */
+#define MAX_WORKERS (MAX_OPEN_FILES - 4)
+
+static const char * const supported_exts[] =
+{
+    ".mp3", ".flac", ".ogg", ".wav", ".m4a",
+};
+
+struct track
+{
+    char *path;   /* rockbox path, "/Music/..." */
+    char *title;
+    char *artist;
+    char *album;
+    unsigned long size;
+    uint32_t title_idx, artist_idx, album_idx, path_idx;
+};
+
+static struct track *tracks;
+static size_t track_count, track_alloc;
+static unsigned long long total_bytes;
+
+/* Workers pick the next unparsed track from here */
+static size_t next_track;
+
+/* The sim file layer allocates descriptors from a shared table; opening and
+ * closing must not race. Reads on distinct descriptors are fine. */
+static pthread_mutex_t fd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static char *xstrdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    return memcpy(xmalloc(len), s, len);
+}
+
+static bool is_supported(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (!ext || ext == name)
+        return false;
+
+    for (size_t i = 0; i < ARRAYLEN(supported_exts); i++) {
+        if (!strcasecmp(ext, supported_exts[i]))
+            return true;
+    }
+    return false;
+}
+
+static void add_track(const char *path, unsigned long size)
+{
+    if (track_count == track_alloc) {
+        track_alloc = track_alloc ? track_alloc * 2 : 1024;
+        tracks = realloc(tracks, track_alloc * sizeof(*tracks));
+        if (!tracks) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    struct track *t = &tracks[track_count++];
+    memset(t, 0, sizeof(*t));
+    t->path = xstrdup(path);
+    t->size = size;
+    total_bytes += size;
+}
+
+static void scan(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (!dir) {
+        fprintf(stderr, "Can't open %s\n", dirname);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        char path[MAX_PATH];
+        size_t len = strlen(dirname);
+        if (len > 0 && dirname[len - 1] == '/')
+            len--;
+        if (snprintf(path, sizeof(path), "%.*s/%s", (int)len, dirname,
+                     entry->d_name) >= (int)sizeof(path))
+            continue;
+
+        struct dirinfo info = dir_get_info(dir, entry);
+        if (info.attribute & ATTR_DIRECTORY)
+            scan(path);
+        else if (is_supported(entry->d_name))
+            add_track(path, info.size);
+    }
+    closedir(dir);
+}
+
+static void parse_track(struct track *t)
+{
+    struct mp3entry id3;
+
+    pthread_mutex_lock(&fd_lock);
+    int fd = open(t->path, O_RDONLY);
+    pthread_mutex_unlock(&fd_lock);
+
+    bool ok = fd >= 0 && get_metadata(&id3, fd, t->path);
+
+    if (fd >= 0) {
+        pthread_mutex_lock(&fd_lock);
+        close(fd);
+        pthread_mutex_unlock(&fd_lock);
+    }
+
+    /* Same fallbacks as the PC app */
+    const char *name = strrchr(t->path, '/') + 1;
+    t->title = xstrdup(ok && id3.title && *id3.title ? id3.title : name);
+    t->artist = xstrdup(ok && id3.artist && *id3.artist ?
+                        id3.artist : "Unknown Artist");
+    t->album = xstrdup(ok && id3.album && *id3.album ?
+                       id3.album : "Unknown Album");
+}
+
+static void *worker(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&next_track, 1, __ATOMIC_RELAXED);
+        if (i >= track_count)
+            break;
+        parse_track(&tracks[i]);
+    }
+    return NULL;
+}
+
+/* Artist -> album -> title, ASCII case folded and compared bytewise so the
+ * order doesn't depend on the host locale. The path breaks remaining ties. */
+static int track_cmp(const void *a, const void *b)
+{
+    const struct track *ta = a, *tb = b;
+    int rc;
+
+    if ((rc = strcasecmp(ta->artist, tb->artist)))
+        return rc;
+    if ((rc = strcasecmp(ta->album, tb->album)))
+        return rc;
+    if ((rc = strcasecmp(ta->title, tb->title)))
+        return rc;
+    return strcmp(ta->path, tb->path);
+}
+
+/* String pool with exact-match dedup */
+static char *pool;
+static size_t pool_size, pool_alloc;
+
+static struct
+{
+    const char *str;
+    uint32_t offset;
+} *pool_hash;
+static size_t pool_hash_size, pool_hash_used;
+
+static uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261u; /* FNV-1a */
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static void pool_hash_insert(const char *str, uint32_t offset)
+{
+    size_t i = str_hash(str) & (pool_hash_size - 1);
+    while (pool_hash[i].str)
+        i = (i + 1) & (pool_hash_size - 1);
+    pool_hash[i].str = str;
+    pool_hash[i].offset = offset;
+    pool_hash_used++;
+}
+
+static uint32_t add_string(const char *s)
+{
+    size_t i = str_hash(s) & (pool_hash_size - 1);
+    while (pool_hash[i].str) {
+        if (!strcmp(pool_hash[i].str, s))
+            return pool_hash[i].offset;
+        i = (i + 1) & (pool_hash_size - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    if (pool_size + len > pool_alloc) {
+        pool_alloc = (pool_size + len) * 2;
+        pool = realloc(pool, pool_alloc);
+        if (!pool) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    uint32_t offset = pool_size;
+    memcpy(pool + offset, s, len);
+    pool_size += len;
+
+    /* The hash keeps pointers to the source strings, which outlive it */
+    pool_hash_insert(s, offset);
+    return offset;
+}
+
+struct u32_array
+{
+    uint32_t *data;
+    size_t count, alloc;
+};
+
+static void u32_push(struct u32_array *a, uint32_t v)
+{
+    if (a->count == a->alloc) {
+        a->alloc = a->alloc ? a->alloc * 2 : 256;
+        a->data = realloc(a->data, a->alloc * sizeof(uint32_t));
+        if (!a->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    a->data[a->count++] = v;
+}
+
+static void put32(FILE *f, uint32_t v)
+{
+    unsigned char b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    fwrite(b, 1, 4, f);
+}
+
+static void put_range(FILE *f, uint32_t start, uint32_t count,
+                      uint32_t album_idx)
+{
+    put32(f, start);
+    put32(f, count);
+    put32(f, album_idx);
+}
+
+/* Prefix index rows before sorting */
+struct sort_item
+{
+    const char *name;
+    uint32_t item;
+    uint32_t name_idx;
+};
+
+static int sort_item_cmp(const void *a, const void *b)
+{
+    const struct sort_item *ia = a, *ib = b;
+    int rc = strcasecmp(ia->name, ib->name);
+    if (rc)
+        return rc;
+    return ia->item < ib->item ? -1 : ia->item > ib->item;
+}
+
+/* Alphabetical index over the first entry of each artist/album, or over
+ * every entry for the titles */
+static void put_prefix_index(FILE *f, const struct u32_array *starts,
+                             int field)
+{
+    size_t n = starts ? starts->count : track_count;
+    struct sort_item *items = xmalloc((n ? n : 1) * sizeof(*items));
+
+    for (size_t i = 0; i < n; i++) {
+        const struct track *t = &tracks[starts ? starts->data[i] : i];
+        items[i].item = i;
+        if (field == 0) {
+            items[i].name = t->artist;
+            items[i].name_idx = t->artist_idx;
+        } else if (field == 1) {
+            items[i].name = t->album;
+            items[i].name_idx = t->album_idx;
+        } else {
+            items[i].name = t->title;
+            items[i].name_idx = t->title_idx;
+        }
+    }
+
+    qsort(items, n, sizeof(*items), sort_item_cmp);
+
+    for (size_t i = 0; i < n; i++) {
+        char key[DB_PREFIX_LEN] = { 0 };
+        for (size_t k = 0; k < DB_PREFIX_LEN && items[i].name[k]; k++) {
+            char c = items[i].name[k];
+            key[k] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+        fwrite(key, 1, DB_PREFIX_LEN, f);
+        put32(f, items[i].item);
+        put32(f, items[i].name_idx);
+    }
+
+    free(items);
+}
+
+static bool write_database(const char *filename)
+{
+    struct u32_array artist_index = { 0 }, album_index = { 0 };
+    struct u32_array artist_group = { 0 }, groups = { 0 };
+    uint32_t cur_artist = UINT32_MAX, cur_album = UINT32_MAX;
+
+    /* Every track adds at most four strings */
+    pool_hash_size = 16;
+    while (pool_hash_size < track_count * 8)
+        pool_hash_size *= 2;
+    pool_hash = calloc(pool_hash_size, sizeof(*pool_hash));
+    if (!pool_hash) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < track_count; i++) {
+        struct track *t = &tracks[i];
+        t->path_idx = add_string(t->path);
+        t->title_idx = add_string(t->title);
+        t->artist_idx = add_string(t->artist);
+        t->album_idx = add_string(t->album);
+
+        bool new_artist = t->artist_idx != cur_artist;
+        bool new_album = t->album_idx != cur_album;
+
+        if (new_artist) {
+            u32_push(&artist_index, i);
+            u32_push(&artist_group, groups.count);
+            cur_artist = t->artist_idx;
+        }
+        if (new_album) {
+            u32_push(&album_index, i);
+            cur_album = t->album_idx;
+        }
+        if (new_artist || new_album)
+            u32_push(&groups, i);
+    }
+    u32_push(&artist_group, groups.count);
+
+    const uint32_t entries_offset = sizeof(struct db_header);
+    const uint32_t artist_index_offset =
+        entries_offset + track_count * sizeof(struct db_entry);
+    const uint32_t album_index_offset =
+        artist_index_offset + artist_index.count * 4;
+    const uint32_t artist_group_offset =
+        album_index_offset + album_index.count * 4;
+    const uint32_t group_table_offset =
+        artist_group_offset + artist_group.count * 4;
+    const uint32_t album_table_offset =
+        group_table_offset + groups.count * sizeof(struct db_album_range);
+    const uint32_t artist_prefix_offset =
+        album_table_offset + album_index.count * sizeof(struct db_album_range);
+    const uint32_t album_prefix_offset =
+        artist_prefix_offset + artist_index.count * sizeof(struct db_prefix);
+    const uint32_t title_prefix_offset =
+        album_prefix_offset + album_index.count * sizeof(struct db_prefix);
+    const uint32_t string_pool_offset =
+        title_prefix_offset + track_count * sizeof(struct db_prefix);
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Can't create %s\n", filename);
+        return false;
+    }
+
+    fwrite(DB_MAGIC, 1, 4, f);
+    put32(f, track_count);
+    put32(f, artist_index.count);
+    put32(f, album_index.count);
+    put32(f, artist_index_offset);
+    put32(f, album_index_offset);
+    put32(f, string_pool_offset);
+    put32(f, groups.count);
+    put32(f, artist_group_offset);
+    put32(f, group_table_offset);
+    put32(f, album_table_offset);
+    put32(f, artist_prefix_offset);
+    put32(f, album_prefix_offset);
+    put32(f, title_prefix_offset);
+
+    for (size_t i = 0; i < track_count; i++) {
+        put32(f, tracks[i].title_idx);
+        put32(f, tracks[i].artist_idx);
+        put32(f, tracks[i].album_idx);
+        put32(f, tracks[i].path_idx);
+    }
+
+    for (size_t i = 0; i < artist_index.count; i++)
+        put32(f, artist_index.data[i]);
+    for (size_t i = 0; i < album_index.count; i++)
+        put32(f, album_index.data[i]);
+    for (size_t i = 0; i < artist_group.count; i++)
+        put32(f, artist_group.data[i]);
+
+    for (size_t i = 0; i < groups.count; i++) {
+        uint32_t start = groups.data[i];
+        uint32_t end = i + 1 < groups.count ? groups.data[i + 1] : track_count;
+        put_range(f, start, end - start, tracks[start].album_idx);
+    }
+    for (size_t i = 0; i < album_index.count; i++) {
+        uint32_t start = album_index.data[i];
+        uint32_t end = i + 1 < album_index.count ?
+                       album_index.data[i + 1] : track_count;
+        put_range(f, start, end - start, tracks[start].album_idx);
+    }
+
+    put_prefix_index(f, &artist_index, 0);
+    put_prefix_index(f, &album_index, 1);
+    put_prefix_index(f, NULL, 2);
+
+    fwrite(pool, 1, pool_size, f);
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0)
+        ok = false;
+
+    fprintf(stderr, "%zu tracks, %zu artists, %zu albums, %zu bytes of "
+            "strings\n", track_count, artist_index.count, album_index.count,
+            pool_size);
+
+    free(artist_index.data);
+    free(album_index.data);
+    free(artist_group.data);
+    free(groups.data);
+    return ok;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-r root] [-o output] [dir...]\n\n"
+            "  -j threads  metadata parser threads (default: one per CPU)\n"
+            "  -r root     top-level directory of the dap (default: .)\n"
+            "  -o output   database file (default: root/database.rdb)\n"
+            "  dir         directories to scan, as seen on the dap "
+            "(default: /)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:r:o:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            sim_root_dir = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_WORKERS)
+        threads = MAX_WORKERS;
+
+    char default_output[MAX_PATH];
+    if (!output) {
+        snprintf(default_output, sizeof(default_output), "%s/database.rdb",
+                 sim_root_dir);
+        output = default_output;
+    }
+
+    fprintf(stderr, "Rockbox RDB generator for '%s'\n\n", TOSTRING(TARGET_NAME));
+
+    double t0 = now();
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++)
+            scan(argv[i]);
+    } else {
+        scan("/");
+    }
+    double t1 = now();
+    fprintf(stderr, "Scan:  %zu files in %.2fs\n", track_count, t1 - t0);
+
+    pthread_t tid[MAX_WORKERS];
+    for (int i = 0; i < threads; i++)
+        pthread_create(&tid[i], NULL, worker, NULL);
+    for (int i = 0; i < threads; i++)
+        pthread_join(tid[i], NULL);
+    double t2 = now();
+
+    double parse_time = t2 - t1 > 0 ? t2 - t1 : 1e-9;
+    fprintf(stderr, "Parse: %zu files, %.1f MiB in %.2fs on %d threads "
+            "(%.0f files/s, %.1f MiB/s)\n", track_count,
+            total_bytes / 1048576.0, t2 - t1, threads,
+            track_count / parse_time, total_bytes / 1048576.0 / parse_time);
+
+    qsort(tracks, track_count, sizeof(*tracks), track_cmp);
+
+    if (!write_database(output))
+        return 1;
+
+    double t3 = now();
+    fprintf(stderr, "Write: %s in %.2fs\n", output, t3 - t2);
+    fprintf(stderr, "Total: %.2fs\n", t3 - t0);
+    return 0;
+}
+
+/* The kernel mutexes used by the codepage code all map onto one host lock */
+#include "kernel.h"
+static pthread_mutex_t kernel_lock;
+static pthread_once_t kernel_lock_once = PTHREAD_ONCE_INIT;
+
+static void kernel_lock_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&kernel_lock, &attr);
+}
+
+void mutex_init(struct mutex *m)
+{
+    (void)m;
+    pthread_once(&kernel_lock_once, kernel_lock_init);
+}
+
+void mutex_lock(struct mutex *m)
+{
+    (void)m;
+    pthread_once(&kernel_lock_once, kernel_lock_init);
+    pthread_mutex_lock(&kernel_lock);
+}
+
+void mutex_unlock(struct mutex *m)
+{
+    (void)m;
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+void sim_thread_lock(void *me)
+{
+    (void)me;
+}
+
+void * sim_thread_unlock(void)
+{
+    return (void*)1;
+}